@@ -0,0 +1,291 @@
+#ifndef AOT_COMPILER_H
+#define AOT_COMPILER_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "llvm_includes.h"
+#include "compilation_context.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Transforms/IPO.h"
+#include "module_manager.h"
+#include "builder_manager.h"
+#include "host_target.h"
+#include "optimizer.h"
+#include "options.h"
+#include "remarks.h"
+#include "trace.h"
+#include "debuginfo/debuginfo_manager.h"
+
+/// aot_compiler - Ahead of time compilation of the whole program into one
+/// module, written out as a native object file or shared library.
+///
+/// Top-level expressions are not run. They become entry functions that the
+/// generated kaleidoscope_main calls in source order. The runtime library
+/// (runtime/) provides putchard, printd and a main that calls
+/// kaleidoscope_main.
+class aot_compiler
+{
+  llvm::TargetMachine *target_machine = 0;
+  llvm::Module *module = 0;
+  llvm::legacy::FunctionPassManager *fpm = 0;
+  std::vector<std::string> entries;
+
+  /// emit_main - Build kaleidoscope_main, running every entry in order and
+  /// returning the value of the last one.
+  void emit_main()
+  {
+    llvm::LLVMContext &Context = compilation_context::current()->get_llvm_context();
+    llvm::Type *DoubleTy = llvm::Type::getDoubleTy(Context);
+
+    llvm::Function *Main = llvm::Function::Create(
+          llvm::FunctionType::get(DoubleTy, false),
+          llvm::Function::ExternalLinkage, "kaleidoscope_main", module);
+
+    llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Context, "entry", Main));
+    llvm::Value *Result = llvm::ConstantFP::get(Context, llvm::APFloat(0.0));
+    for (size_t i = 0; i < entries.size(); i++)
+      Result = Builder.CreateCall(module->getFunction(entries[i]), "result");
+    Builder.CreateRet(Result);
+  }
+
+  bool write_object(const std::string &path)
+  {
+    trace::get_instance()->set_item(path);
+    trace_scope Emit("emit");
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(path, EC, llvm::sys::fs::F_None);
+    if (EC)
+    {
+      fprintf(stderr, "Could not open %s: %s\n", path.c_str(), EC.message().c_str());
+      return false;
+    }
+
+    unsigned level = options::get_instance()->get_opt_level();
+
+    llvm::legacy::PassManager PM;
+    PM.add(new llvm::DataLayoutPass());
+    target_machine->addAnalysisPasses(PM);
+
+    bool whole_program = options::get_instance()->get_whole_program();
+    std::vector<const char *> exports;
+    if (whole_program)
+    {
+      // Only kaleidoscope_main and the entries are called from outside,
+      // everything else becomes internal. GlobalOpt then moves internal
+      // functions whose address is not taken to fastcc, and GlobalDCE drops
+      // the definitions nothing calls.
+      exports.push_back("kaleidoscope_main");
+      for (size_t i = 0; i < entries.size(); i++)
+        exports.push_back(entries[i].c_str());
+      PM.add(llvm::createInternalizePass(exports));
+      PM.add(llvm::createIPSCCPPass());
+      PM.add(llvm::createGlobalOptimizerPass());
+      PM.add(llvm::createGlobalDCEPass());
+    }
+
+    if (level >= 2)
+    {
+      // The functions are already optimized one by one; with the whole
+      // program at hand inline across them and clean up.
+      PM.add(llvm::createFunctionInliningPass(level, 0));
+      PM.add(llvm::createInstructionCombiningPass());
+      PM.add(llvm::createGVNPass());
+      PM.add(llvm::createCFGSimplificationPass());
+    }
+
+    if (whole_program)
+    {
+      // Internal functions that were inlined everywhere are dead now.
+      PM.add(llvm::createArgumentPromotionPass());
+      PM.add(llvm::createDeadArgEliminationPass());
+      PM.add(llvm::createGlobalDCEPass());
+    }
+
+    // The module passes run on their own, so the remarks can count the
+    // optimized IR before code generation lowers it further.
+    bool Remarks = remarks::get_instance()->is_enabled();
+    std::vector<std::string> defined;
+    if (Remarks)
+      defined = remarks::begin_module(*module);
+    PM.run(*module);
+    if (Remarks)
+      remarks::get_instance()->end_module(*module, defined);
+
+    llvm::legacy::PassManager CodeGenPM;
+    CodeGenPM.add(new llvm::DataLayoutPass());
+    target_machine->addAnalysisPasses(CodeGenPM);
+
+    llvm::formatted_raw_ostream FOS(OS);
+    if (target_machine->addPassesToEmitFile(CodeGenPM, FOS, llvm::TargetMachine::CGFT_ObjectFile))
+    {
+      fprintf(stderr, "Target does not support object file emission\n");
+      return false;
+    }
+
+    CodeGenPM.run(*module);
+    return true;
+  }
+
+  /// link - Link object into the shared library path with the system
+  /// compiler driver, $CC or cc. The arguments go to the driver as they are,
+  /// no shell sees the paths; $CC is split at whitespace.
+  bool link(const std::string &object, const std::string &path)
+  {
+    const char *cc = getenv("CC");
+    std::vector<std::string> args;
+    std::istringstream driver(cc && *cc ? cc : "cc");
+    std::string word;
+    while (driver >> word)
+      args.push_back(word);
+    args.push_back("-shared");
+    args.push_back("-o");
+    args.push_back(path);
+    args.push_back(object);
+
+    std::vector<char *> argv;
+    for (size_t i = 0; i < args.size(); i++)
+      argv.push_back(const_cast<char *>(args[i].c_str()));
+    argv.push_back(0);
+
+    fflush(0);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+      perror("fork");
+      return false;
+    }
+    if (pid == 0)
+    {
+      execvp(argv[0], argv.data());
+      perror(argv[0]);
+      _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+      if (errno != EINTR)
+      {
+        perror("waitpid");
+        return false;
+      }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+
+public:
+
+  ~aot_compiler()
+  {
+    delete fpm;
+    delete module;
+    delete target_machine;
+  }
+
+  /// init - Create the target machine for the host and the program module.
+  bool init(std::string &ErrStr)
+  {
+    std::string Triple = llvm::sys::getProcessTriple();
+    const llvm::Target *T = llvm::TargetRegistry::lookupTarget(Triple, ErrStr);
+    if (!T)
+      return false;
+
+    // Position independent, so the object can go into a shared library.
+    target_machine = T->createTargetMachine(
+          Triple, host_target::get_cpu(), host_target::get_feature_string(),
+          host_target::get_target_options(), llvm::Reloc::PIC_, llvm::CodeModel::Default,
+          host_target::get_codegen_level(options::get_instance()->get_opt_level()));
+    if (!target_machine)
+    {
+      ErrStr = "could not create target machine";
+      return false;
+    }
+
+    module = new llvm::Module("kaleidoscope", compilation_context::current()->get_llvm_context());
+    module->setTargetTriple(Triple);
+    module->setDataLayout(target_machine->getSubtargetImpl()->getDataLayout());
+
+    module_manager::get_instance()->set(module);
+
+    if (options::get_instance()->get_debug_info())
+    {
+      // Add the current debug info version into the module.
+      module->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+
+      // Darwin only supports dwarf2.
+      if (llvm::Triple(Triple).isOSDarwin())
+        module->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 2);
+
+      builder_manager::get_instance()->set_di( new llvm::DIBuilder(*module) );
+    }
+    debug_manager::get_instance()->init();
+
+    fpm = new llvm::legacy::FunctionPassManager(module);
+    optimizer::add_function_passes(*fpm, target_machine, options::get_instance()->get_opt_level());
+    fpm->doInitialization();
+    module_manager::get_instance()->set_fpm(fpm);
+    return true;
+  }
+
+  /// add_entry - Run the top-level expression function name from
+  /// kaleidoscope_main.
+  void add_entry(const std::string &name)
+  {
+    entries.push_back(name);
+  }
+
+  /// emit - Finish the module and write it to path: a shared library if
+  /// path ends in ".so", an object file otherwise.
+  bool emit(const std::string &path)
+  {
+    fpm->doFinalization();
+    module_manager::get_instance()->set_fpm(0);
+    if (llvm::DIBuilder *DI = builder_manager::get_instance()->get_di())
+      DI->finalize();
+
+    emit_main();
+    if (llvm::verifyModule(*module, &llvm::errs()))
+      return false;
+
+    if (options::get_instance()->get_dump_ir())
+      module->dump();
+
+    bool shared = path.size() > 3 && !path.compare(path.size() - 3, 3, ".so");
+    if (!shared)
+      return write_object(path);
+
+    // Link the object with the system compiler driver.
+    std::string object = path + ".o";
+    if (!write_object(object))
+      return false;
+
+    bool linked = link(object, path);
+    remove(object.c_str());
+    if (!linked)
+    {
+      fprintf(stderr, "Linking %s failed\n", path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  llvm::Module *get_module()
+  {
+    return module;
+  }
+
+  static aot_compiler* get_instance()
+  {
+    return compilation_context::current()->get<aot_compiler>(compilation_context::c_aot);
+  }
+};
+
+#endif
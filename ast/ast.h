@@ -3,7 +3,13 @@
 
 #include "debuginfo/debuginfo_manager.h"
 #include "ast_expr.h"
+#include "ast_function_prototype.h"
 #include "named_values.h"
+#include "counted_loop.h"
+#include "loop_hints.h"
+#include "class_layout.h"
+#include "jit/profiler.h"
+#include "pgo.h"
 
 //===----------------------------------------------------------------------===//
 // Abstract Syntax Tree (aka Parse Tree)
@@ -19,12 +25,17 @@ vsx_string<> &indent(vsx_string<> &O, int size)
 
 #include "ast_number_expr.h"
 #include "ast_variable_expr.h"
+#include "ast_index_expr.h"
 #include "ast_unary_expr.h"
 #include "ast_binary_expr.h"
 #include "ast_call_expr.h"
 #include "ast_if_expr.h"
 #include "ast_for_expr.h"
+#include "ast_foreach_expr.h"
 #include "ast_var_expr.h"
+#include "ast_sizeof_expr.h"
+#include "ast_tuple_expr.h"
+#include "ast_destructure_expr.h"
 #include "ast_function.h"
 
 
@@ -12,37 +12,81 @@ public:
   {
     out += vsx_string<>("binary") + Op;
     ast_expr::dump(out, ind);
-    vsx_string<> out2 = indent(out, ind) + "LHS:";
-    LHS->dump(out2, ind + 1);
-    out2 = indent(out, ind) + "RHS:";
-    RHS->dump(out2, ind + 1);
+    indent(out, ind) += "LHS:";
+    LHS->dump(out, ind + 1);
+    indent(out, ind) += "RHS:";
+    RHS->dump(out, ind + 1);
   }
+  bool CanRun() override
+  {
+    if (!LHS->CanRun() || !RHS->CanRun())
+      return false;
+    if (Op == '=' || Op == '+' || Op == '-' || Op == '*' || Op == '<')
+      return true;
+    return evaluator::get_instance()->can_call(vsx_string<>("binary") + Op, 2);
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    if (!evaluator::get_instance()->step())
+      return false;
+
+    if (Op == '=') {
+      if (!RHS->Evaluate(Result))
+        return false;
+
+      double *Variable = LHS->EvaluateAddress();
+      if (Variable == 0)
+        return false;
+
+      *Variable = Result;
+      return true;
+    }
+
+    double L, R;
+    if (!LHS->Evaluate(L) || !RHS->Evaluate(R))
+      return false;
+
+    switch (Op) {
+    case '+':
+      Result = L + R;
+      return true;
+    case '-':
+      Result = L - R;
+      return true;
+    case '*':
+      Result = L * R;
+      return true;
+    case '<':
+      // fcmp ult: true if less than or unordered
+      Result = !(L >= R) ? 1.0 : 0.0;
+      return true;
+    default:
+      break;
+    }
+
+    std::vector<double> Args(2);
+    Args[0] = L;
+    Args[1] = R;
+    return evaluator::get_instance()->call(vsx_string<>("binary") + Op, Args, Result);
+  }
+
   llvm::Value *Codegen() override
   {
     debug_manager::get_instance()->emitLocation(this);
 
     // Special case '=' because we don't want to emit the LHS as an expression.
     if (Op == '=') {
-      // Assignment requires the LHS to be an identifier.
-      // This assume we're building without RTTI because LLVM builds that way by
-      // default.  If you build LLVM with RTTI this can be changed to a
-      // dynamic_cast for automatic error checking.
-      ast_variable_expr *LHSE = static_cast<ast_variable_expr *>(LHS);
-      if (!LHSE)
-      {
-        error::print("destination of '=' must be a variable");
-        return 0;
-      }
       // Codegen the RHS.
       llvm::Value *Val = RHS->Codegen();
       if (Val == 0)
         return 0;
 
-      // Look up the name.
-      llvm::Value *Variable = named_values::get_instance()->get( LHSE->getName() );
+      // Assignment requires the LHS to be a variable or an array element.
+      llvm::Value *Variable = LHS->CodegenAddress();
       if (Variable == 0)
       {
-        error::print("Unknown variable name");
+        error::print("destination of '=' must be a variable");
         return 0;
       }
 
@@ -55,6 +99,12 @@ public:
     if (L == 0 || R == 0)
       return 0;
 
+    if (L->getType()->isStructTy() || R->getType()->isStructTy())
+    {
+      error::print("[[...]] can only be returned, not used as an operand");
+      return 0;
+    }
+
     switch (Op) {
     case '+':
       return builder_manager::get_instance()->get_ir()->CreateFAdd(L, R, "addtmp");
@@ -68,7 +118,7 @@ public:
       return
         builder_manager::get_instance()->get_ir()->CreateUIToFP(
           L,
-          llvm::Type::getDoubleTy( llvm::getGlobalContext()),
+          llvm::Type::getDoubleTy( compilation_context::current()->get_llvm_context()),
           "booltmp"
         );
     default:
@@ -77,10 +127,10 @@ public:
 
     // If it wasn't a builtin binary operator, it must be a user defined one. Emit
     // a call to it.
-    llvm::Function *F = module_manager::get_instance()->get()->getFunction(std::string("binary") + Op);
-    assert(F && "binary operator not found!");
+    ast_function_prototype *P = function_registry::get_instance()->get_prototype(vsx_string<>("binary") + Op);
+    assert(P && "binary operator not found!");
 
     llvm::Value *Ops[] = { L, R };
-    return builder_manager::get_instance()->get_ir()->CreateCall(F, Ops, "binop");
+    return P->CodegenCall(Ops, "binop");
   }
 };
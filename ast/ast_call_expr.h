@@ -15,25 +15,53 @@ public:
     ast_expr::dump(out, ind);
     for (ast_expr *Arg : Args)
     {
-      vsx_string<> out2 = indent(out, ind + 1);
-      Arg->dump(out2, ind + 1);
+      indent(out, ind + 1);
+      Arg->dump(out, ind + 1);
     }
   }
 
+  bool CanRun() override
+  {
+    for (ast_expr *Arg : Args)
+      if (!Arg->CanRun())
+        return false;
+    return evaluator::get_instance()->can_call(Callee, Args.size());
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    std::vector<double> ArgsV(Args.size());
+    for (unsigned i = 0, e = Args.size(); i != e; ++i)
+      if (!Args[i]->Evaluate(ArgsV[i]))
+        return false;
+
+    return evaluator::get_instance()->call(Callee, ArgsV, Result);
+  }
+
   llvm::Value *Codegen() override
+  {
+    llvm::Value *V = CodegenAggregate();
+    if (V == 0 || !V->getType()->isStructTy())
+      return V;
+
+    // In a plain expression a multiple result call yields its first result.
+    return builder_manager::get_instance()->get_ir()->CreateExtractValue(V, 0, "result");
+  }
+
+  llvm::Value *CodegenAggregate() override
   {
     debug_manager::get_instance()->emitLocation(this);
 
-    // Look up the name in the global module table.
-    llvm::Function *CalleeF = module_manager::get_instance()->get()->getFunction( std::string(Callee.c_str()) );
-    if (CalleeF == 0)
+    // Look up the name in the global function table.
+    ast_function_prototype *CalleeP = function_registry::get_instance()->get_prototype(Callee);
+    if (CalleeP == 0)
     {
       error::print("Unknown function referenced");
       return 0;
     }
 
     // If argument mismatch error.
-    if (CalleeF->arg_size() != Args.size())
+    if (CalleeP->getArgs().size() != Args.size())
     {
       error::print("Incorrect # arguments passed");
       return 0;
@@ -46,7 +74,7 @@ public:
         return 0;
     }
 
-    return builder_manager::get_instance()->get_ir()->CreateCall(CalleeF, ArgsV, "calltmp");
+    return CalleeP->CodegenCall(ArgsV, "calltmp");
   }
 
 };
@@ -0,0 +1,72 @@
+/// ast_destructure_expr - Expression class for binding the results of a
+/// multiple result call, "var [q, r] = divmod(a, b) in body".
+///
+/// The names are bound directly to the extracted values, no allocas are
+/// created and the names can not be assigned to.
+class ast_destructure_expr : public ast_expr {
+  std::vector<vsx_string<> > Names;
+  ast_expr *Init;
+  ast_expr *Body;
+
+public:
+  ast_destructure_expr(SourceLocation Loc, const std::vector<vsx_string<> > &names,
+                       ast_expr *init, ast_expr *body)
+      : ast_expr(Loc), Names(names), Init(init), Body(body) {}
+
+  void dump(vsx_string<char> &out, int ind) override
+  {
+    out += "var [";
+    for (size_t i = 0; i < Names.size(); i++)
+      out += (i ? vsx_string<>(", ") : vsx_string<>()) + Names[i];
+    out += "]";
+    ast_expr::dump(out, ind);
+    indent(out, ind) += "Init:";
+    Init->dump(out, ind + 1);
+    indent(out, ind) += "Body:";
+    Body->dump(out, ind + 1);
+  }
+
+  llvm::Value *Codegen() override
+  {
+    llvm::Value *Agg = Init->CodegenAggregate();
+    if (Agg == 0)
+      return 0;
+
+    llvm::StructType *ST = llvm::dyn_cast<llvm::StructType>(Agg->getType());
+    if (ST == 0 || ST->getNumElements() != Names.size())
+    {
+      error::print("number of names in var [...] does not match the results");
+      return 0;
+    }
+
+    debug_manager::get_instance()->emitLocation(this);
+
+    std::vector< llvm::AllocaInst *> OldBindings;
+    std::vector< llvm::Value *> OldValues;
+    for (unsigned i = 0, e = Names.size(); i != e; ++i)
+    {
+      OldBindings.push_back( named_values::get_instance()->get( Names[i] ) );
+      OldValues.push_back( named_values::get_instance()->get_value( Names[i] ) );
+
+      named_values::get_instance()->unset( Names[i] );
+      named_values::get_instance()->set_value(
+            Names[i],
+            builder_manager::get_instance()->get_ir()->CreateExtractValue(Agg, i, Names[i].c_str())
+          );
+    }
+
+    llvm::Value *BodyVal = Body->Codegen();
+    if (BodyVal == 0)
+      return 0;
+
+    for (unsigned i = 0, e = Names.size(); i != e; ++i)
+    {
+      named_values::get_instance()->set_value( Names[i], OldValues[i] );
+      if (OldBindings[i])
+        named_values::get_instance()->set( Names[i], OldBindings[i] );
+    }
+
+    return BodyVal;
+  }
+
+};
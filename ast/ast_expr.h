@@ -2,6 +2,8 @@
 #define VX_AST_EXPR_H
 
 #include "llvm_includes.h"
+#include "builder_manager.h"
+#include "evaluator.h"
 #include "parser.h"
 
 
@@ -35,6 +37,56 @@ public:
 
   virtual ~ast_expr() {}
   virtual llvm::Value* Codegen() = 0;
+
+  /// Evaluate - Compute the value at compile time, see evaluator. Returns
+  /// false if the expression is not pure or too expensive to evaluate.
+  virtual bool Evaluate(double &Result)
+  {
+    return false;
+  }
+
+  /// CanRun - Whether the execution tier (evaluator::begin_run) supports
+  /// everything this expression can reach, so running it never gives up
+  /// after calling an extern.
+  virtual bool CanRun()
+  {
+    return false;
+  }
+
+  /// EvaluateAddress - The storage this expression can be assigned through
+  /// during evaluation, or 0.
+  virtual double* EvaluateAddress()
+  {
+    return 0;
+  }
+
+  /// CodegenAddress - Emit the address this expression can be assigned
+  /// through, or 0 if it is not assignable.
+  virtual llvm::Value* CodegenAddress()
+  {
+    return 0;
+  }
+
+  /// CodegenAggregate - Emit this expression keeping multiple results
+  /// together instead of narrowing them to the first one.
+  virtual llvm::Value* CodegenAggregate()
+  {
+    return Codegen();
+  }
+
+  /// CodegenIndex - Emit this expression as an i64 array index.
+  virtual llvm::Value* CodegenIndex()
+  {
+    llvm::Value* V = Codegen();
+    if (V == 0)
+      return 0;
+
+    return builder_manager::get_instance()->get_ir()->CreateFPToSI(
+          V,
+          llvm::Type::getInt64Ty( compilation_context::current()->get_llvm_context() ),
+          "idx"
+        );
+  }
 };
 
 
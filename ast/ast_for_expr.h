@@ -1,54 +1,123 @@
 class ast_for_expr : public ast_expr {
   vsx_string<> VarName;
   ast_expr *Start, *End, *Step, *Body;
+  loop_hints Hints;
 
 public:
   ast_for_expr(const vsx_string<> &varname, ast_expr *start, ast_expr *end,
-             ast_expr *step, ast_expr *body)
-      : VarName(varname), Start(start), End(end), Step(step), Body(body) {}
+             ast_expr *step, ast_expr *body, const loop_hints &hints = loop_hints())
+      : VarName(varname), Start(start), End(end), Step(step), Body(body), Hints(hints) {}
 
   void dump(vsx_string<char> &out, int ind) override
   {
-    out += vsx_string<>("for");
+    out += vsx_string<>("for ") + VarName;
     ast_expr::dump(out, ind);
-    vsx_string<> out2;
 
-    out2 = indent(out, ind) + "Cond:";
-    Start->dump(out2, ind + 1);
+    indent(out, ind) += "Start:";
+    Start->dump(out, ind + 1);
 
-    out2 = indent(out, ind) + "End:";
-    End->dump(out2, ind + 1);
+    indent(out, ind) += "End:";
+    End->dump(out, ind + 1);
 
-    out2 = indent(out, ind) + "Step:";
-    Step->dump(out2, ind + 1);
+    if (Step)
+    {
+      indent(out, ind) += "Step:";
+      Step->dump(out, ind + 1);
+    }
+
+    indent(out, ind) += "Body:";
+    Body->dump(out, ind + 1);
+  }
+
+  bool CanRun() override
+  {
+    return Start->CanRun() && End->CanRun() && (!Step || Step->CanRun()) && Body->CanRun();
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    evaluator *E = evaluator::get_instance();
+
+    double StartVal, StepVal = 1.0, EndVal;
+    if (!Start->Evaluate(StartVal))
+      return false;
+    if (Step && !Step->Evaluate(StepVal))
+      return false;
+
+    evaluator::binding Old = E->bind(VarName, StartVal);
+    bool Ok = true;
+    while (Ok)
+    {
+      if (!E->back_edge() || !End->Evaluate(EndVal))
+      {
+        Ok = false;
+        break;
+      }
+      if (!(EndVal != 0.0 && EndVal == EndVal))
+        break;
+
+      double BodyVal;
+      if (!Body->Evaluate(BodyVal))
+      {
+        Ok = false;
+        break;
+      }
+
+      *E->get_address(VarName) += StepVal;
+    }
+    E->restore(VarName, Old);
+
+    // for expr always returns 0.0.
+    Result = 0.0;
+    return Ok;
+  }
+
+  /// CodegenEndCond - Evaluate End and convert it to a bool by comparing
+  /// not equal to 0.0.
+  llvm::Value *CodegenEndCond()
+  {
+    llvm::Value *EndCond = End->Codegen();
+    if (EndCond == 0)
+      return 0;
 
-    out2 = indent(out, ind) + "Body:";
-    Body->dump(out2, ind + 1);
+    return builder_manager::get_instance()->get_ir()->CreateFCmpONE(
+        EndCond, llvm::ConstantFP::get( compilation_context::current()->get_llvm_context(), llvm::APFloat(0.0)), "loopcond");
   }
 
   llvm::Value *Codegen() override
   {
-    // Output this as:
+    // Output this as a rotated loop:
     //   var = alloca double
     //   ...
     //   start = startexpr
     //   store start -> var
-    //   goto loop
+    //   step = stepexpr
+    //   endcond = endexpr
+    //   br endcond, preheader, afterloop
+    // preheader:
+    //   br loop
     // loop:
     //   ...
     //   bodyexpr
     //   ...
-    // loopend:
-    //   step = stepexpr
-    //   endcond = endexpr
-    //
+    // latch:
     //   curvar = load var
     //   nextvar = curvar + step
     //   store nextvar -> var
-    //   br endcond, loop, endloop
-    // outloop:
+    //   endcond = endexpr
+    //   br endcond, loop, loopexit      ; !llvm.loop
+    // loopexit:
+    //   br afterloop
+    // afterloop:
+    //
+    // The step is evaluated once, before the loop. The end condition is
+    // checked before every iteration, so the body never runs when it is false
+    // for the start value.
 
-    llvm::Function *TheFunction = builder_manager::get_instance()->get_ir()->GetInsertBlock()->getParent();
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    int Site = pgo::get_instance()->add_site();
+    const uint64_t *Counts = pgo::get_instance()->get_counts(Site);
 
     // Create an alloca for the variable in the entry block.
     llvm::AllocaInst *Alloca = llvm_helper::CreateEntryBlockAlloca(TheFunction, std::string(VarName.c_str()));
@@ -61,65 +130,98 @@ public:
       return 0;
 
     // Store the value into the alloca.
-    builder_manager::get_instance()->get_ir()->CreateStore(StartVal, Alloca);
-
-    // Make the new basic block for the loop header, inserting after current
-    // block.
-    llvm::BasicBlock *LoopBB =
-        llvm::BasicBlock::Create( llvm::getGlobalContext(), "loop", TheFunction);
-
-    // Insert an explicit fall through from the current block to the LoopBB.
-    builder_manager::get_instance()->get_ir()->CreateBr(LoopBB);
+    Builder->CreateStore(StartVal, Alloca);
 
-    // Start insertion in LoopBB.
-    builder_manager::get_instance()->get_ir()->SetInsertPoint(LoopBB);
+    // Emit the step value, also without 'variable' in scope.
+    llvm::Value *StepVal;
+    if (Step) {
+      StepVal = Step->Codegen();
+      if (StepVal == 0)
+        return 0;
+    } else {
+      // If not specified, use 1.0.
+      StepVal = llvm::ConstantFP::get( compilation_context::current()->get_llvm_context(), llvm::APFloat(1.0));
+    }
 
-    // Within the loop, the variable is defined equal to the PHI node.  If it
+    // Within the loop, the variable is defined equal to the alloca.  If it
     // shadows an existing variable, we have to restore it, so save it now.
     llvm::AllocaInst *OldVal = named_values::get_instance()->get( VarName );
     named_values::get_instance()->set( VarName, Alloca );
 
+    // Guard: check the end condition for the start value.
+    llvm::Value *GuardCond = CodegenEndCond();
+    if (GuardCond == 0)
+      return 0;
+
+    llvm::BasicBlock *PreheaderBB =
+        llvm::BasicBlock::Create( compilation_context::current()->get_llvm_context(), "preheader", TheFunction);
+    llvm::BasicBlock *LoopBB =
+        llvm::BasicBlock::Create( compilation_context::current()->get_llvm_context(), "loop", TheFunction);
+    llvm::BasicBlock *ExitBB =
+        llvm::BasicBlock::Create( compilation_context::current()->get_llvm_context(), "loopexit");
+    llvm::BasicBlock *AfterBB =
+        llvm::BasicBlock::Create( compilation_context::current()->get_llvm_context(), "afterloop");
+
+    pgo::get_instance()->count(Site, pgo::loop_reached);
+    llvm::BranchInst *Guard = Builder->CreateCondBr(GuardCond, PreheaderBB, AfterBB);
+    if (Counts)
+      pgo::set_weights(Guard, Counts[pgo::loop_entered],
+                       Counts[pgo::loop_reached] - Counts[pgo::loop_entered]);
+
+    Builder->SetInsertPoint(PreheaderBB);
+    llvm::AllocaInst *Iterations = 0;
+    if (options::get_instance()->get_profile_loops())
+      Iterations = profiler::get_instance()->begin_loop();
+    pgo::get_instance()->count(Site, pgo::loop_entered);
+    llvm::AllocaInst *ProfiledIterations = pgo::get_instance()->begin_loop(Site);
+    Builder->CreateBr(LoopBB);
+
+    // Start insertion in LoopBB.
+    Builder->SetInsertPoint(LoopBB);
+    if (Iterations)
+      profiler::get_instance()->count_iteration(Iterations);
+    if (ProfiledIterations)
+      profiler::get_instance()->count_iteration(ProfiledIterations);
+
     // Emit the body of the loop.  This, like any other expr, can change the
     // current BB.  Note that we ignore the value computed by the body, but don't
     // allow an error.
     if (Body->Codegen() == 0)
       return 0;
 
-    // Emit the step value.
-    llvm::Value *StepVal;
-    if (Step) {
-      StepVal = Step->Codegen();
-      if (StepVal == 0)
-        return 0;
-    } else {
-      // If not specified, use 1.0.
-      StepVal = llvm::ConstantFP::get( llvm::getGlobalContext(), llvm::APFloat(1.0));
-    }
-
-    // Compute the end condition.
-    llvm::Value *EndCond = End->Codegen();
-    if (EndCond == 0)
-      return EndCond;
-
     // Reload, increment, and restore the alloca.  This handles the case where
     // the body of the loop mutates the variable.
-    llvm::Value *CurVar = builder_manager::get_instance()->get_ir()->CreateLoad(Alloca, VarName.c_str());
-    llvm::Value *NextVar = builder_manager::get_instance()->get_ir()->CreateFAdd(CurVar, StepVal, "nextvar");
-    builder_manager::get_instance()->get_ir()->CreateStore(NextVar, Alloca);
+    llvm::Value *CurVar = Builder->CreateLoad(Alloca, VarName.c_str());
+    llvm::Value *NextVar = Builder->CreateFAdd(CurVar, StepVal, "nextvar");
+    Builder->CreateStore(NextVar, Alloca);
 
-    // Convert condition to a bool by comparing equal to 0.0.
-    EndCond = builder_manager::get_instance()->get_ir()->CreateFCmpONE(
-        EndCond, llvm::ConstantFP::get( llvm::getGlobalContext(), llvm::APFloat(0.0)), "loopcond");
-
-    // Create the "after loop" block and insert it.
-    llvm::BasicBlock *AfterBB =
-        llvm::BasicBlock::Create( llvm::getGlobalContext(), "afterloop", TheFunction);
+    // Compute the end condition for the next iteration.
+    llvm::Value *EndCond = CodegenEndCond();
+    if (EndCond == 0)
+      return 0;
 
-    // Insert the conditional branch into the end of LoopEndBB.
-    builder_manager::get_instance()->get_ir()->CreateCondBr(EndCond, LoopBB, AfterBB);
+    // The single latch, carrying the loop hints.
+    llvm::BranchInst *Latch = Builder->CreateCondBr(EndCond, LoopBB, ExitBB);
+    if (llvm::MDNode *LoopID = Hints.get_loop_id())
+      Latch->setMetadata("llvm.loop", LoopID);
+
+    // Every entry leaves through the latch once, all other iterations take
+    // the back edge.
+    if (Counts)
+      pgo::set_weights(Latch, Counts[pgo::loop_iterations] - Counts[pgo::loop_entered],
+                       Counts[pgo::loop_entered]);
+
+    // Dedicated exit block, then the code after the loop.
+    TheFunction->getBasicBlockList().push_back(ExitBB);
+    Builder->SetInsertPoint(ExitBB);
+    if (Iterations)
+      profiler::get_instance()->end_loop(Iterations, getLine(), getCol());
+    pgo::get_instance()->end_loop(Site, ProfiledIterations);
+    Builder->CreateBr(AfterBB);
 
     // Any new code will be inserted in AfterBB.
-    builder_manager::get_instance()->get_ir()->SetInsertPoint(AfterBB);
+    TheFunction->getBasicBlockList().push_back(AfterBB);
+    Builder->SetInsertPoint(AfterBB);
 
     // Restore the unshadowed variable.
     if (OldVal)
@@ -128,7 +230,6 @@ public:
       named_values::get_instance()->unset( VarName );
 
     // for expr always returns 0.0.
-    return llvm::Constant::getNullValue( llvm::Type::getDoubleTy( llvm::getGlobalContext() ) );
+    return llvm::Constant::getNullValue( llvm::Type::getDoubleTy( compilation_context::current()->get_llvm_context() ) );
   }
 };
-
@@ -0,0 +1,136 @@
+/// ast_foreach_expr - Expression class for foreach (array) and
+/// foreach (array, index).
+///
+/// Lowered to a counted loop over the (fixed) element count of the array, with
+/// the loop vectorizer explicitly enabled. The value of the expression is the
+/// value of the body in the last iteration (0.0 for an empty array), so a
+/// reduction can be written as:
+///
+///   var sum = 0 in foreach (data) sum = sum + *data
+///
+/// The adds of such a reduction are strict IEEE and have to stay in order, so
+/// the vectorizer leaves the loop scalar unless the function is declared
+/// fastmath or built with -ffast-math. Element wise bodies vectorize either
+/// way.
+class ast_foreach_expr : public ast_expr {
+  vsx_string<> ArrayName;
+  vsx_string<> IndexName;
+  ast_expr *Body;
+
+public:
+  ast_foreach_expr(SourceLocation Loc, const vsx_string<> &arrayname,
+                   const vsx_string<> &indexname, ast_expr *body)
+      : ast_expr(Loc), ArrayName(arrayname), IndexName(indexname), Body(body) {}
+
+  void dump(vsx_string<char> &out, int ind) override
+  {
+    out += vsx_string<>("foreach ") + ArrayName;
+    if (IndexName.size())
+      out += vsx_string<>(", ") + IndexName;
+    ast_expr::dump(out, ind);
+    indent(out, ind) += "Body:";
+    Body->dump(out, ind + 1);
+  }
+
+  bool CanRun() override
+  {
+    return Body->CanRun();
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    evaluator *E = evaluator::get_instance();
+    std::vector<double> *Array = E->get_array(ArrayName);
+    if (Array == 0)
+      return false;
+
+    auto &Cursors = E->get_cursors();
+    bool HadCursor = Cursors.find(ArrayName) != Cursors.end();
+    size_t OldCursor = HadCursor ? Cursors[ArrayName] : 0;
+
+    evaluator::binding OldIndex;
+    if (IndexName.size())
+      OldIndex = E->bind(IndexName, 0.0);
+
+    bool Ok = true;
+    Result = 0.0;
+    for (size_t i = 0, e = Array->size(); i != e && Ok; ++i)
+    {
+      Cursors[ArrayName] = i;
+      if (IndexName.size())
+        *E->get_address(IndexName) = (double)i;
+      Ok = E->back_edge() && Body->Evaluate(Result);
+    }
+
+    if (HadCursor)
+      Cursors[ArrayName] = OldCursor;
+    else
+      Cursors.erase(ArrayName);
+    if (IndexName.size())
+      E->restore(IndexName, OldIndex);
+    return Ok;
+  }
+
+  llvm::Value *Codegen() override
+  {
+    llvm::AllocaInst *Array = named_values::get_instance()->get_array(ArrayName);
+    if (Array == 0)
+    {
+      error::print("Unknown array name in foreach");
+      return 0;
+    }
+
+    debug_manager::get_instance()->emitLocation(this);
+
+    uint64_t Count = Array->getAllocatedType()->getArrayNumElements();
+
+    counted_loop Loop;
+    llvm::Value *Idx = Loop.begin(
+          llvm::ConstantInt::get( llvm::Type::getInt64Ty( compilation_context::current()->get_llvm_context() ), Count ),
+          "foreach"
+        );
+
+    // Within the loop *array refers to the current element, and the index
+    // name (if any) shadows any variable of the same name.
+    llvm::Value *OldCursor = named_values::get_instance()->get_cursor( ArrayName );
+    named_values::get_instance()->set_cursor( ArrayName, Idx );
+
+    llvm::AllocaInst *OldVal = 0;
+    llvm::Value *OldIndex = 0;
+    llvm::Value *OldValue = 0;
+    if (IndexName.size())
+    {
+      OldVal = named_values::get_instance()->get( IndexName );
+      OldIndex = named_values::get_instance()->get_index( IndexName );
+      OldValue = named_values::get_instance()->get_value( IndexName );
+      named_values::get_instance()->unset( IndexName );
+      named_values::get_instance()->set_value( IndexName, 0 );
+      named_values::get_instance()->set_index( IndexName, Idx );
+    }
+
+    llvm::Value *BodyVal = Body->Codegen();
+    if (BodyVal == 0)
+      return 0;
+
+    loop_hints Hints;
+    Hints.vectorize = true;
+    Loop.end( Hints.get_loop_id() );
+
+    llvm::PHINode *PN =
+        builder_manager::get_instance()->get_ir()->CreatePHI( BodyVal->getType(), 2, "foreachtmp");
+    PN->addIncoming( llvm::Constant::getNullValue( BodyVal->getType() ), Loop.get_guard_block() );
+    PN->addIncoming( BodyVal, Loop.get_exit_block() );
+
+    // Restore the outer bindings.
+    named_values::get_instance()->set_cursor( ArrayName, OldCursor );
+    if (IndexName.size())
+    {
+      named_values::get_instance()->set_index( IndexName, OldIndex );
+      named_values::get_instance()->set_value( IndexName, OldValue );
+      if (OldVal)
+        named_values::get_instance()->set( IndexName, OldVal );
+    }
+
+    return PN;
+  }
+};
@@ -1,5 +1,9 @@
 #include "ast_function_prototype.h"
 #include "ast_expr.h"
+#include "jit/tiering.h"
+#include "jit/profiler.h"
+#include "pgo.h"
+#include "remarks.h"
 
 /// ast_function - This class represents a function definition itself.
 class ast_function {
@@ -19,11 +23,21 @@ public:
 
   }
 
+  ast_function_prototype *getProto()
+  {
+    return Proto;
+  }
+
+  ast_expr *getBody()
+  {
+    return Body;
+  }
+
   virtual void dump(vsx_string<char> &out, int ind)
   {
-    out += indent(out, ind) + "ast_function\n";
+    indent(out, ind) += "ast_function\n";
     ++ind;
-    out += indent(out, ind) + "Body:";
+    indent(out, ind) += "Body:";
     if (Body)
       Body->dump(out, ind);
     else
@@ -34,6 +48,22 @@ public:
   {
     named_values::get_instance()->clear();
 
+    // A redefinition replaces the function for every later call. It gets a
+    // symbol of its own, name.N, and has to keep the signature since callers
+    // generated against the old one stay in place.
+    ast_function *Old = function_registry::get_instance()->get_function(Proto->getName());
+    ast_function_prototype *OldProto = function_registry::get_instance()->get_prototype(Proto->getName());
+    if (Old)
+    {
+      if (Old->getProto()->getFunctionType() != Proto->getFunctionType())
+      {
+        error::print("redefinition of function with a different signature");
+        return 0;
+      }
+      unsigned Count = function_registry::get_instance()->get_definition_count(Proto->getName());
+      Proto->setSymbolName(Proto->getSymbolName() + "." + vsx_string_helper::i2s(Count + 1));
+    }
+
     llvm::Function *TheFunction = Proto->Codegen();
     if (TheFunction == 0)
       return 0;
@@ -52,26 +82,81 @@ public:
       binop::get_instance()->setPrecedence( Proto->getOperatorName(), Proto->getBinaryPrecedence() );
 
     // Create a new basic block to start insertion into.
-    llvm::BasicBlock *BB = llvm::BasicBlock::Create( llvm::getGlobalContext(), "entry", TheFunction);
+    llvm::BasicBlock *BB = llvm::BasicBlock::Create( compilation_context::current()->get_llvm_context(), "entry", TheFunction);
     builder_manager::get_instance()->get_ir()->SetInsertPoint(BB);
 
     // Add all arguments to the symbol table and create their allocas.
     Proto->CreateArgumentAllocas(TheFunction);
 
+    llvm::Value *ProfileStart = 0;
+    if (options::get_instance()->get_profile())
+      ProfileStart = profiler::get_instance()->emit_function_entry();
+
+    // Branches and loops are matched to the profile by the hash of the body.
+    pgo *PGO = pgo::get_instance();
+    if (PGO->is_generating() || PGO->is_using())
+    {
+      vsx_string<> Dump;
+      dump(Dump, 0);
+      PGO->begin_function(Proto->getName().c_str(), pgo::hash_body(Dump.c_str()));
+    }
+
     debug_manager::get_instance()->emitLocation(Body);
 
-    if (llvm::Value *RetVal = Body->Codegen()) {
+    // Fast math for the whole program or for this function.
+    bool FastMath = options::get_instance()->get_fast_math() || Proto->isFastMath();
+    if (FastMath)
+    {
+      TheFunction->addFnAttr("unsafe-fp-math", "true");
+      TheFunction->addFnAttr("no-nans-fp-math", "true");
+      TheFunction->addFnAttr("no-infs-fp-math", "true");
+    }
+    builder_manager::get_instance()->set_fast_math(FastMath);
+
+    llvm::Value *RetVal = Body->Codegen();
+    builder_manager::get_instance()->set_fast_math(false);
+    PGO->end_function();
+    if (RetVal && RetVal->getType() != TheFunction->getReturnType())
+    {
+      error::print(Proto->hasAggregateResult() ?
+                     "function with multiple results must return [[...]]" :
+                     "[[...]] returned from a function with a single result");
+      RetVal = 0;
+    }
+
+    if (RetVal) {
+      if (ProfileStart)
+        profiler::get_instance()->emit_function_exit(ProfileStart);
+
       // Finish off the function.
       builder_manager::get_instance()->get_ir()->CreateRet(RetVal);
 
+      if (memory_stats::get_instance()->is_enabled())
+        memory_stats::get_instance()->add_instructions(Proto->getName().c_str(), TheFunction);
+
       // Pop off the lexical block for the function.
-      debug_manager::get_instance()->getLexicalBlocks()->pop_back();
+      debug_manager::get_instance()->removeFunctionScopeFromLexicalBlocks();
 
       // Validate the generated code, checking for consistency.
-      verifyFunction(*TheFunction);
+      {
+        trace_scope Verify("verify");
+        verifyFunction(*TheFunction);
+      }
+
+      // Optimize the function, unless the compile pipeline does it later.
+      if (llvm::legacy::FunctionPassManager *FPM = module_manager::get_instance()->get_fpm())
+      {
+        trace_scope Optimize("optimize");
+        bool Remarks = remarks::get_instance()->is_enabled();
+        if (Remarks)
+          remarks::get_instance()->begin_function(*TheFunction);
+        FPM->run(*TheFunction);
+        if (Remarks)
+          remarks::get_instance()->end_function(*TheFunction);
+      }
 
-      // Optimize the function.
-      TheFPM->run(*TheFunction);
+      // Make the definition available to the compile time evaluator.
+      function_registry::get_instance()->set_function(Proto->getName(), this);
 
       return TheFunction;
     }
@@ -79,13 +164,108 @@ public:
     // Error reading body, remove function.
     TheFunction->eraseFromParent();
 
+    // The previous definition or extern stays in effect. Without one the
+    // name is unknown again, so later calls are reported instead of calling
+    // a symbol that is never defined.
+    if (OldProto)
+      function_registry::get_instance()->set_prototype(Proto->getName(), OldProto);
+    else
+      function_registry::get_instance()->erase_prototype(Proto->getName());
+
     if (Proto->isBinaryOp())
       binop::get_instance()->removePrecedence( Proto->getOperatorName() );
 
     // Pop off the lexical block for the function since we added it
     // unconditionally.
-    debug_manager::get_instance()->getLexicalBlocks()->pop_back();
+    debug_manager::get_instance()->removeFunctionScopeFromLexicalBlocks();
 
     return 0;
   }
 };
+
+/// evaluator::call - Evaluate a user defined function with the given
+/// arguments in a fresh scope. When running, externs and functions that are
+/// already compiled are called natively instead.
+inline bool evaluator::call(const vsx_string<> &name, std::vector<double> &args, double &result)
+{
+  ast_function *F = function_registry::get_instance()->get_function(name);
+
+  if (running)
+  {
+    jit_engine *JIT = jit_engine::get_instance();
+    uint64_t Address = F ? JIT->get_compiled(name.c_str()) : JIT->get_host_symbol(name.c_str());
+
+    // Too deep for the interpreter, run the rest of the recursion natively.
+    if (!Address && F && depth >= max_depth && !F->getProto()->hasAggregateResult())
+      Address = JIT->compile_function(name.c_str());
+
+    if (Address && jit_engine::call(Address, args, result))
+    {
+      side_effects = true;
+      return true;
+    }
+
+    if (F)
+      tiering::get_instance()->count_call(name);
+  }
+
+  if (F == 0 || F->getProto()->hasAggregateResult())
+    return false;
+
+  const std::vector< vsx_string<> > &ArgNames = F->getProto()->getArgs();
+  if (ArgNames.size() != args.size() || depth >= max_depth || !step())
+    return false;
+
+  // The callee sees only its own arguments.
+  std::map<vsx_string<>, double> caller_variables;
+  std::map<vsx_string<>, std::vector<double> > caller_arrays;
+  std::map<vsx_string<>, size_t> caller_cursors;
+  caller_variables.swap(variables);
+  caller_arrays.swap(arrays);
+  caller_cursors.swap(cursors);
+
+  for (size_t i = 0; i < args.size(); i++)
+    variables[ArgNames[i]] = args[i];
+
+  vsx_string<> caller = current;
+  current = name;
+
+  depth++;
+  bool ok = F->getBody()->Evaluate(result);
+  depth--;
+
+  current = caller;
+  variables.swap(caller_variables);
+  arrays.swap(caller_arrays);
+  cursors.swap(caller_cursors);
+  return ok;
+}
+
+inline bool evaluator::can_call(const vsx_string<> &name, size_t args)
+{
+  if (args > jit_engine::max_call_args)
+    return false;
+
+  ast_function *F = function_registry::get_instance()->get_function(name);
+  if (F == 0)
+    return function_registry::get_instance()->get_prototype(name) &&
+           jit_engine::get_instance()->get_host_symbol(name.c_str());
+
+  if (F->getProto()->hasAggregateResult() || F->getProto()->getArgs().size() != args)
+    return false;
+
+  // A recursive call is fine if the rest of the body is.
+  if (checking.count(name))
+    return true;
+  checking.insert(name);
+  bool ok = F->getBody()->CanRun();
+  checking.erase(name);
+  return ok;
+}
+
+inline bool evaluator::back_edge()
+{
+  if (running && current.size())
+    tiering::get_instance()->count_back_edge(current);
+  return step();
+}
@@ -9,6 +9,8 @@
 #include "source_location.h"
 #include "error.h"
 #include "parser.h"
+#include "function_registry.h"
+#include "jit/jit_engine.h"
 
 #include "debuginfo/debuginfo_manager.h"
 
@@ -17,8 +19,13 @@
 class ast_function_prototype
 {
   vsx_string<> Name;
+  vsx_string<> SymbolName; // name of the generated function, name.N for redefinitions,
+                           // with the prefix of its compilation context
   std::vector<vsx_string<> > Args;
+  std::vector<vsx_string<> > Results; // named results, more than one => aggregate return
+  std::vector<double> ResultDefaults;
   bool isOperator;
+  bool FastMath = false;
   unsigned Precedence; // Precedence if a binary op.
   int Line;
 
@@ -29,11 +36,16 @@ public:
       const vsx_string<> &name,
       const std::vector<vsx_string<> > &args,
       bool isoperator = false,
-      unsigned prec = 0
+      unsigned prec = 0,
+      const std::vector<vsx_string<> > &results = std::vector<vsx_string<> >(),
+      const std::vector<double> &resultdefaults = std::vector<double>()
   )
       :
         Name(name),
+        SymbolName(compilation_context::current()->get_symbol_prefix().c_str() + name),
         Args(args),
+        Results(results),
+        ResultDefaults(resultdefaults),
         isOperator(isoperator),
         Precedence(prec),
         Line(Loc.Line)
@@ -62,10 +74,84 @@ public:
     return Precedence;
   }
 
+  const vsx_string<> &getName() const
+  {
+    return Name;
+  }
+
+  const vsx_string<> &getSymbolName() const
+  {
+    return SymbolName;
+  }
+
+  void setSymbolName(const vsx_string<> &symbol)
+  {
+    SymbolName = symbol;
+  }
+
+  /// isFastMath - Declared with the fastmath attribute.
+  bool isFastMath() const
+  {
+    return FastMath;
+  }
+
+  bool hasAggregateResult() const
+  {
+    return Results.size() > 1;
+  }
+
+  /// getReturnType - double, or a literal struct of doubles for functions
+  /// with multiple results. Small structs are returned in registers.
+  llvm::Type *getReturnType() const
+  {
+    llvm::Type *DoubleTy = llvm::Type::getDoubleTy(compilation_context::current()->get_llvm_context());
+    if (!hasAggregateResult())
+      return DoubleTy;
+
+    std::vector<llvm::Type *> Elements(Results.size(), DoubleTy);
+    return llvm::StructType::get(compilation_context::current()->get_llvm_context(), Elements);
+  }
+
+  llvm::FunctionType *getFunctionType() const
+  {
+    std::vector<llvm::Type *> Doubles(Args.size(),
+                                llvm::Type::getDoubleTy(compilation_context::current()->get_llvm_context()));
+    return llvm::FunctionType::get(getReturnType(), Doubles, false);
+  }
+
+  /// GetDeclaration - This function in the current module, declared on first
+  /// use since every definition is generated into a module of its own.
+  llvm::Function *GetDeclaration()
+  {
+    llvm::Module *M = module_manager::get_instance()->get();
+    if (llvm::Function *F = M->getFunction(SymbolName.c_str()))
+      return F;
+
+    return llvm::Function::Create(getFunctionType(), llvm::Function::ExternalLinkage,
+                                  std::string(SymbolName.c_str()), M);
+  }
+
+  /// CodegenCall - Emit a call to this function. Calls to functions the JIT
+  /// compiles lazily go through their dispatch slot, so a redefinition can
+  /// be swapped in; externs and recursive calls are direct.
+  llvm::Value *CodegenCall(llvm::ArrayRef<llvm::Value *> ArgsV, const char *TmpName)
+  {
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    llvm::Function *Caller = Builder->GetInsertBlock()->getParent();
+    std::string FnName(Name.c_str());
+
+    if (Caller->getName() != SymbolName.c_str() && jit_engine::get_instance()->is_lazy(FnName))
+      return jit_engine::get_instance()->emit_slot_call(FnName, getFunctionType(), ArgsV, TmpName);
+
+    return Builder->CreateCall(GetDeclaration(), ArgsV, TmpName);
+  }
+
   /// prototype
-  ///   ::= id '(' id* ')'
+  ///   ::= id '(' id* ')' results? 'fastmath'?
   ///   ::= binary LETTER number? (id, id)
   ///   ::= unary LETTER (id)
+  /// results
+  ///   ::= ':' '(' (id ('=' number)?)+ ')'
   static ast_function_prototype* parse()
   {
     vsx_string<> FnName = parser::get()->get_identifier();
@@ -144,6 +230,55 @@ public:
     // success.
     parser::get()->get_next_token(); // eat ')'.
 
+    std::vector<vsx_string<>> ResultNames;
+    std::vector<double> ResultDefaults;
+    if (parser::get()->get_current_token() == ':')
+    {
+      parser::get()->get_next_token(); // eat ':'.
+      if (parser::get()->get_current_token() != '(')
+      {
+        error::print("Expected '(' after ':' in prototype. Example: divmod (a b) : (q r)");
+        return 0;
+      }
+
+      parser::get()->get_next_token(); // eat '('.
+
+      while (parser::get()->get_current_token() == tok_identifier)
+      {
+        ResultNames.push_back( parser::get()->get_identifier() );
+        ResultDefaults.push_back(0.0);
+        parser::get()->get_next_token(); // eat result name.
+
+        if (parser::get()->get_current_token() != '=')
+          continue;
+
+        if (parser::get()->get_next_token() != tok_number)
+        {
+          error::print("Expected number as default result value");
+          return 0;
+        }
+        ResultDefaults.back() = parser::get()->get_number_value();
+        parser::get()->get_next_token(); // eat the number.
+      }
+
+      if (parser::get()->get_current_token() != ')' || ResultNames.empty())
+      {
+        error::print("Expected result names and ')' in prototype");
+        return 0;
+      }
+      parser::get()->get_next_token(); // eat ')'.
+    }
+
+    // fastmath lets the floating point math of the body be reordered, e.g.
+    // to vectorize a reduction. It is a keyword, so a body starting with a
+    // variable cannot be taken for it.
+    bool FastMath = false;
+    if (parser::get()->get_current_token() == tok_fastmath)
+    {
+      FastMath = true;
+      parser::get()->get_next_token(); // eat 'fastmath'.
+    }
+
     // Verify right number of names for operator.
     if (Kind && ArgNames.size() != Kind)
     {
@@ -151,28 +286,28 @@ public:
       return 0;
     }
 
-    return new ast_function_prototype(FnLoc, FnName, ArgNames, Kind != 0, BinaryPrecedence);
+    ast_function_prototype *Proto =
+        new ast_function_prototype(FnLoc, FnName, ArgNames, Kind != 0, BinaryPrecedence, ResultNames, ResultDefaults);
+    Proto->FastMath = FastMath;
+    return Proto;
   }
 
   llvm::Function* Codegen() {
     // Make the function type:  double(double,double) etc.
-    std::vector<llvm::Type *> Doubles(Args.size(),
-                                llvm::Type::getDoubleTy(llvm::getGlobalContext()));
-    llvm::FunctionType *FT =
-        llvm::FunctionType::get(llvm::Type::getDoubleTy(llvm::getGlobalContext()), Doubles, false);
+    llvm::FunctionType *FT = getFunctionType();
 
     llvm::Function *F =
-        llvm::Function::Create(FT, llvm::Function::ExternalLinkage, std::string(Name.c_str()), module_manager::get_instance()->get() );
+        llvm::Function::Create(FT, llvm::Function::ExternalLinkage, std::string(SymbolName.c_str()), module_manager::get_instance()->get() );
 
     printf("Func name: %s\n", Name.c_str() );
     fflush(stdout);
 
     // If F conflicted, there was already something named 'Name'.  If it has a
     // body, don't allow redefinition or reextern.
-    if (F->getName() != std::string(Name.c_str())) {
+    if (F->getName() != std::string(SymbolName.c_str())) {
       // Delete the one we just made and get the existing one.
       F->eraseFromParent();
-      F = module_manager::get_instance()->get()->getFunction(Name.c_str());
+      F = module_manager::get_instance()->get()->getFunction(SymbolName.c_str());
 
 
       // If F already has a body, reject this.
@@ -186,8 +321,16 @@ public:
         error::print("redefinition of function with different # args");
         return 0;
       }
+
+      // If F returned a different number of results, reject.
+      if (F->getReturnType() != FT->getReturnType()) {
+        error::print("redefinition of function with different results");
+        return 0;
+      }
     }
 
+    function_registry::get_instance()->set_prototype(Name, this);
+
     // Set names for all arguments.
     unsigned Idx = 0;
     for (llvm::Function::arg_iterator AI = F->arg_begin(); Idx != Args.size();
@@ -195,30 +338,7 @@ public:
       AI->setName(Args[Idx].c_str());
 
     // Create a subprogram DIE for this function.
-    llvm::DIFile Unit = builder_manager::get_instance()->get_di()->createFile(
-      debug_manager::get_instance()->getCU()->getFilename(),
-      debug_manager::get_instance()->getCU()->getDirectory()
-    );
-    //DIScope *FContext = Unit;
-    unsigned LineNo = Line;
-    unsigned ScopeLine = Line;
-    llvm::DISubprogram* SP = new llvm::DISubprogram;
-    *SP = builder_manager::get_instance()->get_di()->createFunction(
-        Unit, // ok
-        Name.c_str(), // ok
-        llvm::StringRef(), // ok
-        Unit, // ok
-        LineNo, // ok
-        *debug_manager::get_instance()->CreateFunctionType(Args.size(), &Unit), // ok
-        false /* internal linkage */,
-        true /* definition */,
-        ScopeLine,
-        llvm::DIDescriptor::FlagPrototyped,
-        false,
-        F
-      );
-
-    debug_manager::get_instance()->addFunctionScopeMap(this, SP);
+    debug_manager::get_instance()->emitFunction(this, F, Name.c_str(), Line, Args.size());
     return F;
   }
 
@@ -234,24 +354,7 @@ public:
       llvm::AllocaInst *Alloca = llvm_helper::CreateEntryBlockAlloca(F, Args[Idx].c_str() );
 
       // Create a debug descriptor for the variable.
-      llvm::DIScope *Scope = debug_manager::get_instance()->getLexicalBlocks()->back();
-
-      auto Unit = builder_manager::get_instance()->get_di()->createFile(
-            debug_manager::get_instance()->getCU()->getFilename(),
-            debug_manager::get_instance()->getCU()->getDirectory()
-          );
-
-
-      auto D = builder_manager::get_instance()->get_di()->createLocalVariable(
-          llvm::dwarf::DW_TAG_arg_variable, *Scope, Args[Idx].c_str(), Unit, Line,
-          *debug_manager::get_instance()->getDoubleTy(), Idx);
-
-      builder_manager::get_instance()->get_di()->insertDeclare(
-            Alloca,
-            D,
-            builder_manager::get_instance()->get_di()->createExpression(),
-            builder_manager::get_instance()->get_ir()->GetInsertBlock()
-            );
+      debug_manager::get_instance()->emitArgument(Alloca, Args[Idx].c_str(), Line, Idx + 1);
 
       // Store the initial value into the alloca.
       builder_manager::get_instance()->get_ir()->CreateStore(AI, Alloca);
@@ -265,6 +368,16 @@ public:
   {
     return Args;
   }
+
+  const std::vector< vsx_string<> > &getResults() const
+  {
+    return Results;
+  }
+
+  const std::vector< double > &getResultDefaults() const
+  {
+    return ResultDefaults;
+  }
 };
 
 #endif
@@ -24,14 +24,30 @@ public:
   {
     out += vsx_string<>("if");
     ast_expr::dump(out, ind);
-    vsx_string<> out2;
-
-    out2 = indent(out, ind) + "Cond:";
-    Cond->dump(out2, ind + 1);
-    out2 = indent(out, ind) + "Then:";
-    Then->dump(out2, ind + 1);
-    out2 = indent(out, ind) + "Else:";
-    Else->dump(out2, ind + 1);
+
+    indent(out, ind) += "Cond:";
+    Cond->dump(out, ind + 1);
+    indent(out, ind) += "Then:";
+    Then->dump(out, ind + 1);
+    indent(out, ind) += "Else:";
+    Else->dump(out, ind + 1);
+  }
+
+  bool CanRun() override
+  {
+    return Cond->CanRun() && Then->CanRun() && Else->CanRun();
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    double CondV;
+    if (!Cond->Evaluate(CondV))
+      return false;
+
+    // fcmp one: true if ordered and not equal to 0.0
+    if (CondV != 0.0 && CondV == CondV)
+      return Then->Evaluate(Result);
+    return Else->Evaluate(Result);
   }
 
   llvm::Value *Codegen() override
@@ -48,7 +64,7 @@ public:
         CreateFCmpONE(
           CondV,
           llvm::ConstantFP::get(
-            llvm::getGlobalContext(),
+            compilation_context::current()->get_llvm_context(),
             llvm::APFloat(0.0)
           ),
           "ifcond"
@@ -58,14 +74,18 @@ public:
 
     // Create blocks for the then and else cases.  Insert the 'then' block at the
     // end of the function.
-    llvm::BasicBlock *ThenBB  = llvm::BasicBlock::Create( llvm::getGlobalContext(), "then", TheFunction);
-    llvm::BasicBlock *ElseBB  = llvm::BasicBlock::Create( llvm::getGlobalContext(), "else");
-    llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create( llvm::getGlobalContext(), "ifcont");
+    llvm::BasicBlock *ThenBB  = llvm::BasicBlock::Create( compilation_context::current()->get_llvm_context(), "then", TheFunction);
+    llvm::BasicBlock *ElseBB  = llvm::BasicBlock::Create( compilation_context::current()->get_llvm_context(), "else");
+    llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create( compilation_context::current()->get_llvm_context(), "ifcont");
 
-    builder_manager::get_instance()->get_ir()->CreateCondBr(CondV, ThenBB, ElseBB);
+    int Site = pgo::get_instance()->add_site();
+    llvm::BranchInst *Branch = builder_manager::get_instance()->get_ir()->CreateCondBr(CondV, ThenBB, ElseBB);
+    if (const uint64_t *Counts = pgo::get_instance()->get_counts(Site))
+      pgo::set_weights(Branch, Counts[pgo::if_then], Counts[pgo::if_else]);
 
     // Emit then value.
     builder_manager::get_instance()->get_ir()->SetInsertPoint(ThenBB);
+    pgo::get_instance()->count(Site, pgo::if_then);
 
     llvm::Value *ThenV = Then->Codegen();
     if (ThenV == 0)
@@ -78,6 +98,7 @@ public:
     // Emit else block.
     TheFunction->getBasicBlockList().push_back(ElseBB);
     builder_manager::get_instance()->get_ir()->SetInsertPoint(ElseBB);
+    pgo::get_instance()->count(Site, pgo::if_else);
 
     llvm::Value *ElseV = Else->Codegen();
     if (ElseV == 0)
@@ -90,8 +111,14 @@ public:
     // Emit merge block.
     TheFunction->getBasicBlockList().push_back(MergeBB);
     builder_manager::get_instance()->get_ir()->SetInsertPoint(MergeBB);
+    if (ThenV->getType() != ElseV->getType())
+    {
+      error::print("then and else must both return the same number of results");
+      return 0;
+    }
+
     llvm::PHINode *PN =
-        builder_manager::get_instance()->get_ir()->CreatePHI( llvm::Type::getDoubleTy( llvm::getGlobalContext()), 2, "iftmp");
+        builder_manager::get_instance()->get_ir()->CreatePHI( ThenV->getType(), 2, "iftmp");
 
     PN->addIncoming(ThenV, ThenBB);
     PN->addIncoming(ElseV, ElseBB);
@@ -0,0 +1,107 @@
+/// ast_index_expr - Expression class for array element access, "data[i]",
+/// or "*data" for the current element of an enclosing foreach (data).
+class ast_index_expr : public ast_expr {
+  vsx_string<char> Name;
+  ast_expr *Index;
+
+public:
+  ast_index_expr(SourceLocation Loc, const vsx_string<> &name, ast_expr *index)
+      : ast_expr(Loc), Name(name), Index(index) {}
+
+  void dump(vsx_string<char> &out, int ind) override
+  {
+    out += (Index ? vsx_string<>("index ") : vsx_string<>("deref ")) + Name;
+    ast_expr::dump(out, ind);
+    if (Index)
+    {
+      indent(out, ind) += "Index:";
+      Index->dump(out, ind + 1);
+    }
+  }
+
+  /// EvaluateAddress - The element this expression refers to during
+  /// compile time evaluation, or 0.
+  double *EvaluateAddress() override
+  {
+    std::vector<double> *Array = evaluator::get_instance()->get_array(Name);
+    if (Array == 0)
+      return 0;
+
+    size_t Idx;
+    if (Index)
+    {
+      double IdxVal;
+      if (!Index->Evaluate(IdxVal))
+        return 0;
+      if (!(IdxVal >= 0.0) || IdxVal >= (double)Array->size())
+        return 0;
+      Idx = (size_t)IdxVal;
+    }
+    else
+    {
+      auto &Cursors = evaluator::get_instance()->get_cursors();
+      if (Cursors.find(Name) == Cursors.end())
+        return 0;
+      Idx = Cursors[Name];
+    }
+
+    return &(*Array)[Idx];
+  }
+
+  bool CanRun() override
+  {
+    return !Index || Index->CanRun();
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    double *Element = EvaluateAddress();
+    if (Element == 0)
+      return false;
+    Result = *Element;
+    return true;
+  }
+
+  llvm::Value *CodegenAddress() override
+  {
+    llvm::AllocaInst *Array = named_values::get_instance()->get_array(Name);
+    if (Array == 0)
+    {
+      error::print("Unknown array name");
+      return 0;
+    }
+
+    llvm::Value *Idx;
+    if (Index)
+      Idx = Index->CodegenIndex();
+    else
+    {
+      Idx = named_values::get_instance()->get_cursor(Name);
+      if (Idx == 0)
+      {
+        error::print("'*' on an array is only valid inside foreach over that array");
+        return 0;
+      }
+    }
+    if (Idx == 0)
+      return 0;
+
+    llvm::Value *Ops[] =
+    {
+      llvm::ConstantInt::get( llvm::Type::getInt64Ty( compilation_context::current()->get_llvm_context() ), 0 ),
+      Idx
+    };
+    return builder_manager::get_instance()->get_ir()->CreateInBoundsGEP(Array, Ops, (Name + "elt").c_str());
+  }
+
+  llvm::Value *Codegen() override
+  {
+    llvm::Value *Ptr = CodegenAddress();
+    if (Ptr == 0)
+      return 0;
+
+    debug_manager::get_instance()->emitLocation(this);
+    return builder_manager::get_instance()->get_ir()->CreateAlignedLoad(Ptr, sizeof(double), Name.c_str());
+  }
+
+};
@@ -11,14 +11,28 @@ public:
 
   void dump(vsx_string<char> &out, int ind)
   {
-    out += vsx_string_helper::f2s(Val);
+    // All digits, the dump identifies function bodies for pgo.
+    char Buf[32];
+    snprintf(Buf, sizeof(Buf), "%.17g", Val);
+    out += Buf;
     ast_expr::dump(out, ind);
   }
 
+  bool CanRun()
+  {
+    return true;
+  }
+
+  bool Evaluate(double &Result)
+  {
+    Result = Val;
+    return true;
+  }
+
   llvm::Value *Codegen()
   {
     debug_manager::get_instance()->emitLocation(this);
-    return llvm::ConstantFP::get( llvm::getGlobalContext(), llvm::APFloat(Val) );
+    return llvm::ConstantFP::get( compilation_context::current()->get_llvm_context(), llvm::APFloat(Val) );
   }
 
 };
@@ -1,13 +1,18 @@
 #ifndef VX_AST_PARSE_H
 #define VX_AST_PARSE_H
 
+#include <atomic>
+#include <memory>
+
 #include "ast_function_prototype.h"
 #include "parser.h"
 
 static ast_expr *ParseExpression();
+static ast_expr *ParseBinOpRHS(int ExprPrec, ast_expr *LHS);
 
 /// identifierexpr
 ///   ::= identifier
+///   ::= identifier '[' expression ']'
 ///   ::= identifier '(' expression* ')'
 static ast_expr *ParseIdentifierExpr()
 {
@@ -17,6 +22,23 @@ static ast_expr *ParseIdentifierExpr()
 
   parser::get()->get_next_token(); // eat identifier.
 
+  if (parser::get()->get_current_token() == '[') // Array element.
+  {
+    parser::get()->get_next_token(); // eat [
+    ast_expr *Index = ParseExpression();
+    if (!Index)
+      return 0;
+
+    if (parser::get()->get_current_token() != ']')
+    {
+      error::print("expected ']' after array index");
+      return 0;
+    }
+    parser::get()->get_next_token(); // eat ]
+
+    return new ast_index_expr(LitLoc, IdName, Index);
+  }
+
   if (parser::get()->get_current_token() != '(') // Simple variable ref.
     return new ast_variable_expr(LitLoc, IdName);
 
@@ -108,7 +130,45 @@ static ast_expr *ParseIfExpr() {
   return new ast_if_expr(IfLoc, Cond, Then, Else);
 }
 
-/// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
+/// loophints
+///   ::= ('unroll' number | 'vectorize' number? | 'interleave' number)*
+static bool ParseLoopHints(loop_hints &Hints) {
+  while (parser::get()->get_current_token() == tok_identifier) {
+    vsx_string<> Hint = parser::get()->get_identifier();
+    if (Hint != "unroll" && Hint != "vectorize" && Hint != "interleave")
+    {
+      error::print("unknown loop hint, expected unroll, vectorize or interleave");
+      return false;
+    }
+    parser::get()->get_next_token(); // eat the hint.
+
+    unsigned Count = 0;
+    if (parser::get()->get_current_token() == tok_number) {
+      Count = (unsigned)parser::get()->get_number_value();
+      parser::get()->get_next_token(); // eat the number.
+    }
+
+    if (Hint == "vectorize") {
+      Hints.vectorize = true;
+      Hints.vectorize_width = Count;
+      continue;
+    }
+
+    if (Count < 1)
+    {
+      error::print("unroll and interleave need a count");
+      return false;
+    }
+
+    if (Hint == "unroll")
+      Hints.unroll = Count;
+    else
+      Hints.interleave = Count;
+  }
+  return true;
+}
+
+/// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? loophints 'in' expression
 static ast_expr *ParseForExpr() {
   parser::get()->get_next_token(); // eat the for.
 
@@ -151,6 +211,10 @@ static ast_expr *ParseForExpr() {
       return 0;
   }
 
+  loop_hints Hints;
+  if (!ParseLoopHints(Hints))
+    return 0;
+
   if (parser::get()->get_current_token() != tok_in)
   {
     error::print("expected 'in' after for");
@@ -162,15 +226,116 @@ static ast_expr *ParseForExpr() {
   if (Body == 0)
     return 0;
 
-  return new ast_for_expr(IdName, Start, End, Step, Body);
+  return new ast_for_expr(IdName, Start, End, Step, Body, Hints);
 }
 
-/// varexpr ::= 'var' identifier ('=' expression)?
-//                    (',' identifier ('=' expression)?)* 'in' expression
+/// foreachexpr ::= 'foreach' '(' identifier (',' identifier)? ')' expression
+static ast_expr *ParseForeachExpr() {
+  SourceLocation ForeachLoc = parser::get()->get_current_location();
+
+  parser::get()->get_next_token(); // eat the foreach.
+
+  if (parser::get()->get_current_token() != '(')
+  {
+    error::print("expected '(' after foreach");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat '('.
+
+  if (parser::get()->get_current_token() != tok_identifier)
+  {
+    error::print("expected array name after foreach");
+    return 0;
+  }
+  vsx_string<> ArrayName = parser::get()->get_identifier();
+  parser::get()->get_next_token(); // eat identifier.
+
+  // The index name is optional.
+  vsx_string<> IndexName;
+  if (parser::get()->get_current_token() == ',') {
+    parser::get()->get_next_token();
+    if (parser::get()->get_current_token() != tok_identifier)
+    {
+      error::print("expected index name after ',' in foreach");
+      return 0;
+    }
+    IndexName = parser::get()->get_identifier();
+    parser::get()->get_next_token(); // eat identifier.
+  }
+
+  if (parser::get()->get_current_token() != ')')
+  {
+    error::print("expected ')' in foreach");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat ')'.
+
+  ast_expr *Body = ParseExpression();
+  if (Body == 0)
+    return 0;
+
+  return new ast_foreach_expr(ForeachLoc, ArrayName, IndexName, Body);
+}
+
+/// destructureexpr ::= 'var' '[' identifier (',' identifier)* ']' '=' expression 'in' expression
+static ast_expr *ParseDestructureExpr(SourceLocation VarLoc) {
+  parser::get()->get_next_token(); // eat the '['.
+
+  std::vector<vsx_string<> > Names;
+  while (parser::get()->get_current_token() == tok_identifier) {
+    Names.push_back( parser::get()->get_identifier() );
+    parser::get()->get_next_token(); // eat identifier.
+
+    if (parser::get()->get_current_token() != ',')
+      break;
+    parser::get()->get_next_token(); // eat the ','.
+  }
+
+  if (Names.empty() || parser::get()->get_current_token() != ']')
+  {
+    error::print("expected identifier list and ']' after 'var ['");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat the ']'.
+
+  if (parser::get()->get_current_token() != '=')
+  {
+    error::print("expected '=' after 'var [...]'");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat the '='.
+
+  ast_expr *Init = ParseExpression();
+  if (Init == 0)
+    return 0;
+
+  if (parser::get()->get_current_token() != tok_in)
+  {
+    error::print("expected 'in' keyword after 'var [...]'");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat 'in'.
+
+  ast_expr *Body = ParseExpression();
+  if (Body == 0)
+    return 0;
+
+  return new ast_destructure_expr(VarLoc, Names, Init, Body);
+}
+
+/// varexpr ::= 'var' identifier ('[' number ']')? ('=' expression)?
+//                    (',' identifier ('[' number ']')? ('=' expression)?)* 'in' expression
+//          ::= destructureexpr
 static ast_expr *ParseVarExpr() {
+  SourceLocation VarLoc = parser::get()->get_current_location();
+
   parser::get()->get_next_token(); // eat the var.
 
+  if (parser::get()->get_current_token() == '[')
+    return ParseDestructureExpr(VarLoc);
+
   std::vector<std::pair<vsx_string<>, ast_expr *> > VarNames;
+  std::vector<uint64_t> ArraySizes;
 
   // At least one variable name is required.
   if (parser::get()->get_current_token() != tok_identifier)
@@ -183,6 +348,27 @@ static ast_expr *ParseVarExpr() {
     vsx_string<> Name = parser::get()->get_identifier();
     parser::get()->get_next_token(); // eat identifier.
 
+    // Read the optional array size.
+    uint64_t Size = 0;
+    if (parser::get()->get_current_token() == '[') {
+      parser::get()->get_next_token(); // eat the '['.
+
+      if (parser::get()->get_current_token() != tok_number || parser::get()->get_number_value() < 1)
+      {
+        error::print("expected array size after '['");
+        return 0;
+      }
+      Size = (uint64_t)parser::get()->get_number_value();
+      parser::get()->get_next_token(); // eat the number.
+
+      if (parser::get()->get_current_token() != ']')
+      {
+        error::print("expected ']' after array size");
+        return 0;
+      }
+      parser::get()->get_next_token(); // eat the ']'.
+    }
+
     // Read the optional initializer.
     ast_expr *Init = 0;
     if (parser::get()->get_current_token() == '=') {
@@ -194,6 +380,7 @@ static ast_expr *ParseVarExpr() {
     }
 
     VarNames.push_back(std::make_pair(Name, Init));
+    ArraySizes.push_back(Size);
 
     // End of var list, exit loop.
     if (parser::get()->get_current_token() != ',')
@@ -219,7 +406,101 @@ static ast_expr *ParseVarExpr() {
   if (Body == 0)
     return 0;
 
-  return new ast_var_expr(VarNames, Body);
+  return new ast_var_expr(VarNames, ArraySizes, Body);
+}
+
+/// tupleexpr ::= '[' '[' ((identifier '=')? expression ',')* ']' ']'
+static ast_expr *ParseTupleExpr() {
+  SourceLocation TupleLoc = parser::get()->get_current_location();
+
+  parser::get()->get_next_token(); // eat the first '['.
+  if (parser::get()->get_current_token() != '[')
+  {
+    error::print("expected '[[' to start a result tuple");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat the second '['.
+
+  std::vector<std::pair<vsx_string<>, ast_expr *> > Elements;
+  while (parser::get()->get_current_token() != ']')
+  {
+    vsx_string<> Name;
+    ast_expr *Value;
+    if (parser::get()->get_current_token() == tok_identifier)
+    {
+      // "name = expr" names a result, anything else is positional.
+      vsx_string<> IdName = parser::get()->get_identifier();
+      ast_expr *LHS = ParseIdentifierExpr();
+      if (!LHS)
+        return 0;
+
+      if (parser::get()->get_current_token() == '=')
+      {
+        parser::get()->get_next_token(); // eat '='.
+        Name = IdName;
+        Value = ParseExpression();
+      }
+      else
+        Value = ParseBinOpRHS(0, LHS);
+    }
+    else
+      Value = ParseExpression();
+
+    if (!Value)
+      return 0;
+    Elements.push_back(std::make_pair(Name, Value));
+
+    if (parser::get()->get_current_token() == ']')
+      break;
+
+    if (parser::get()->get_current_token() != ',')
+    {
+      error::print("expected ',' or ']]' in result tuple");
+      return 0;
+    }
+    parser::get()->get_next_token(); // eat ','.
+  }
+
+  parser::get()->get_next_token(); // eat the first ']'.
+  if (parser::get()->get_current_token() != ']')
+  {
+    error::print("expected ']]' to end a result tuple");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat the second ']'.
+
+  return new ast_tuple_expr(TupleLoc, Elements);
+}
+
+/// sizeofexpr ::= 'sizeof' '(' identifier ')'
+static ast_expr *ParseSizeofExpr() {
+  SourceLocation SizeofLoc = parser::get()->get_current_location();
+
+  parser::get()->get_next_token(); // eat the sizeof.
+
+  if (parser::get()->get_current_token() != '(')
+  {
+    error::print("expected '(' after sizeof");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat '('.
+
+  if (parser::get()->get_current_token() != tok_identifier)
+  {
+    error::print("expected class name in sizeof");
+    return 0;
+  }
+  vsx_string<> ClassName = parser::get()->get_identifier();
+  parser::get()->get_next_token(); // eat identifier.
+
+  if (parser::get()->get_current_token() != ')')
+  {
+    error::print("expected ')' after sizeof");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat ')'.
+
+  return new ast_sizeof_expr(SizeofLoc, ClassName);
 }
 
 /// primary
@@ -228,7 +509,10 @@ static ast_expr *ParseVarExpr() {
 ///   ::= parenexpr
 ///   ::= ifexpr
 ///   ::= forexpr
+///   ::= foreachexpr
 ///   ::= varexpr
+///   ::= sizeofexpr
+///   ::= tupleexpr
 static ast_expr *ParsePrimary() {
   switch (parser::get()->get_current_token())
   {
@@ -247,22 +531,38 @@ static ast_expr *ParsePrimary() {
       return ParseIfExpr();
     case tok_for:
       return ParseForExpr();
+    case tok_foreach:
+      return ParseForeachExpr();
     case tok_var:
       return ParseVarExpr();
+    case tok_sizeof:
+      return ParseSizeofExpr();
+    case '[':
+      return ParseTupleExpr();
   }
 }
 
 /// unary
 ///   ::= primary
+///   ::= '*' identifier
 ///   ::= '!' unary
 static ast_expr *ParseUnary() {
   // If the current token is not an operator, it must be a primary expr.
-  if (!isascii(parser::get()->get_current_token()) || parser::get()->get_current_token() == '(' || parser::get()->get_current_token() == ',')
+  if (!isascii(parser::get()->get_current_token()) || parser::get()->get_current_token() == '(' || parser::get()->get_current_token() == ',' || parser::get()->get_current_token() == '[')
     return ParsePrimary();
 
   // If this is a unary operator, read it.
   int Opc = parser::get()->get_current_token();
+  SourceLocation OpLoc = parser::get()->get_current_location();
   parser::get()->get_next_token();
+
+  // '*' on an array name is the current element of a foreach.
+  if (Opc == '*' && parser::get()->get_current_token() == tok_identifier)
+  {
+    vsx_string<> ArrayName = parser::get()->get_identifier();
+    parser::get()->get_next_token(); // eat identifier.
+    return new ast_index_expr(OpLoc, ArrayName, 0);
+  }
   if (ast_expr *Operand = ParseUnary())
     return new ast_unary_expr(Opc, Operand);
   return 0;
@@ -332,14 +632,173 @@ static ast_function* parse_function()
 static ast_function *ParseTopLevelExpr() {
   SourceLocation FnLoc = parser::get()->get_current_location();
   if (ast_expr *E = ParseExpression()) {
-    // Make an anonymous proto.
+    // Make an anonymous proto, named uniquely so every top-level expression
+    // can be compiled and run on its own. Unique across compilation contexts,
+    // which share the JIT.
+    static std::atomic<int> TopLevelCount(0);
+    vsx_string<> Name = vsx_string<>("__anon_expr") + vsx_string_helper::i2s(TopLevelCount++);
     ast_function_prototype *Proto =
-        new ast_function_prototype(FnLoc, "main", std::vector< vsx_string<> >());
+        new ast_function_prototype(FnLoc, Name, std::vector< vsx_string<> >());
     return new ast_function(Proto, E);
   }
   return 0;
 }
 
+/// classfield ::= identifier identifier ('[' number ']')? (('=' number) | ('(' number ')'))?
+static bool ParseClassField(class_layout *Class)
+{
+  class_field Field;
+  Field.name = parser::get()->get_identifier();
+  parser::get()->get_next_token(); // eat field name.
+
+  if (parser::get()->get_current_token() != tok_identifier)
+  {
+    error::print("expected type after class field name");
+    return false;
+  }
+  Field.type_name = parser::get()->get_identifier();
+
+  if (class_layout *Nested = class_registry::get_instance()->get(Field.type_name))
+  {
+    Field.type = Nested->type;
+    Field.size = Nested->size;
+    Field.alignment = Nested->alignment;
+  }
+  else if (!class_layout::scalar_type(Field.type_name, Field))
+  {
+    error::print("unknown type for class field");
+    return false;
+  }
+  parser::get()->get_next_token(); // eat type.
+
+  // element count, "m f32[16]"
+  if (parser::get()->get_current_token() == '[') {
+    parser::get()->get_next_token(); // eat '['.
+    if (parser::get()->get_current_token() != tok_number || parser::get()->get_number_value() < 1)
+    {
+      error::print("expected element count after '['");
+      return false;
+    }
+    Field.count = (uint64_t)parser::get()->get_number_value();
+    parser::get()->get_next_token(); // eat the number.
+    if (parser::get()->get_current_token() != ']')
+    {
+      error::print("expected ']' after element count");
+      return false;
+    }
+    parser::get()->get_next_token(); // eat ']'.
+  }
+
+  // default value, "= 1" or "(1)"
+  bool HasDefault = true;
+  int Close = 0;
+  if (parser::get()->get_current_token() == '=')
+    parser::get()->get_next_token();
+  else if (parser::get()->get_current_token() == '(') {
+    parser::get()->get_next_token();
+    Close = ')';
+  }
+  else
+    HasDefault = false;
+  if (HasDefault) {
+    if (parser::get()->get_current_token() != tok_number)
+    {
+      error::print("expected number as class field default value");
+      return false;
+    }
+    Field.has_default = true;
+    Field.default_value = parser::get()->get_number_value();
+    parser::get()->get_next_token(); // eat the number.
+
+    if (Close && parser::get()->get_current_token() != Close)
+    {
+      error::print("expected ')' after class field default value");
+      return false;
+    }
+    if (Close)
+      parser::get()->get_next_token();
+  }
+
+  Class->fields.push_back(Field);
+  return true;
+}
+
+/// classdef
+///   ::= 'class' identifier '{' ('options' ':' option*)? classfield* '}'
+/// option
+///   ::= 'pack' | 'reorder' | 'align_bytes' number
+static class_layout *ParseClass()
+{
+  parser::get()->get_next_token(); // eat class.
+
+  if (parser::get()->get_current_token() != tok_identifier)
+  {
+    error::print("expected class name");
+    return 0;
+  }
+
+  std::unique_ptr<class_layout> Class(new class_layout);
+  Class->name = parser::get()->get_identifier();
+  parser::get()->get_next_token(); // eat name.
+
+  if (parser::get()->get_current_token() != '{')
+  {
+    error::print("expected '{' after class name");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat '{'.
+
+  while (parser::get()->get_current_token() == tok_identifier)
+  {
+    if (parser::get()->get_identifier() != "options")
+    {
+      if (!ParseClassField(Class.get()))
+        return 0;
+      continue;
+    }
+
+    parser::get()->get_next_token(); // eat options.
+    if (parser::get()->get_current_token() != ':')
+    {
+      error::print("expected ':' after options");
+      return 0;
+    }
+    parser::get()->get_next_token(); // eat ':'.
+
+    while (parser::get()->get_current_token() == tok_identifier)
+    {
+      vsx_string<> Option = parser::get()->get_identifier();
+      if (Option == "pack")
+        Class->pack = true;
+      else if (Option == "reorder")
+        Class->reorder = true;
+      else if (Option == "align_bytes")
+      {
+        parser::get()->get_next_token(); // eat align_bytes.
+        uint64_t Align = (uint64_t)parser::get()->get_number_value();
+        if (parser::get()->get_current_token() != tok_number || !Align || (Align & (Align - 1)))
+        {
+          error::print("align_bytes must be followed by a power of two");
+          return 0;
+        }
+        Class->align_bytes = Align;
+      }
+      else
+        break;
+      parser::get()->get_next_token();
+    }
+  }
+
+  if (parser::get()->get_current_token() != '}')
+  {
+    error::print("expected '}' at end of class");
+    return 0;
+  }
+  parser::get()->get_next_token(); // eat '}'.
+
+  return Class.release();
+}
+
 /// external ::= 'extern' prototype
 static ast_function_prototype *ParseExtern() {
   parser::get()->get_next_token(); // eat extern.
@@ -0,0 +1,43 @@
+/// ast_sizeof_expr - Expression class for sizeof(class), a compile time
+/// constant taken from the computed class layout.
+class ast_sizeof_expr : public ast_expr {
+  vsx_string<> ClassName;
+
+public:
+  ast_sizeof_expr(SourceLocation Loc, const vsx_string<> &classname)
+      : ast_expr(Loc), ClassName(classname) {}
+
+  void dump(vsx_string<char> &out, int ind) override
+  {
+    out += vsx_string<>("sizeof ") + ClassName;
+    ast_expr::dump(out, ind);
+  }
+
+  bool CanRun() override
+  {
+    return class_registry::get_instance()->get(ClassName) != 0;
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    class_layout *Layout = class_registry::get_instance()->get(ClassName);
+    if (Layout == 0)
+      return false;
+    Result = (double)Layout->size;
+    return true;
+  }
+
+  llvm::Value *Codegen() override
+  {
+    class_layout *Layout = class_registry::get_instance()->get(ClassName);
+    if (Layout == 0)
+    {
+      error::print("Unknown class name in sizeof");
+      return 0;
+    }
+
+    debug_manager::get_instance()->emitLocation(this);
+    return llvm::ConstantFP::get( compilation_context::current()->get_llvm_context(), llvm::APFloat( (double)Layout->size ) );
+  }
+
+};
@@ -0,0 +1,82 @@
+/// ast_tuple_expr - Expression class for returning multiple results,
+/// "[[q = a, r = b]]" or positionally "[[a, b]]". Results that are not given
+/// take the default from the prototype.
+class ast_tuple_expr : public ast_expr {
+  std::vector<std::pair<vsx_string<>, ast_expr *> > Elements; // name is empty when positional
+
+public:
+  ast_tuple_expr(SourceLocation Loc, const std::vector<std::pair<vsx_string<>, ast_expr *> > &elements)
+      : ast_expr(Loc), Elements(elements) {}
+
+  void dump(vsx_string<char> &out, int ind) override
+  {
+    out += "tuple";
+    ast_expr::dump(out, ind);
+    for (const auto &Element : Elements)
+    {
+      indent(out, ind) += Element.first + ":";
+      Element.second->dump(out, ind + 1);
+    }
+  }
+
+  llvm::Value *Codegen() override
+  {
+    llvm::Function *TheFunction = builder_manager::get_instance()->get_ir()->GetInsertBlock()->getParent();
+    // Redefinitions are named name.N, see ast_function::Codegen.
+    ast_function_prototype *Proto = function_registry::get_instance()->get_prototype( TheFunction->getName().split('.').first.str().c_str() );
+    if (Proto == 0 || !Proto->hasAggregateResult())
+    {
+      error::print("[[...]] is only valid in a function with multiple results");
+      return 0;
+    }
+
+    const std::vector< vsx_string<> > &Results = Proto->getResults();
+    if (Elements.size() > Results.size())
+    {
+      error::print("too many values in [[...]]");
+      return 0;
+    }
+
+    std::vector<llvm::Value *> Values(Results.size(), (llvm::Value *)0);
+    for (unsigned i = 0, e = Elements.size(); i != e; ++i)
+    {
+      unsigned Slot = i;
+      if (Elements[i].first.size())
+      {
+        Slot = Results.size();
+        for (unsigned r = 0; r != Results.size(); ++r)
+          if (Results[r] == Elements[i].first)
+            Slot = r;
+
+        if (Slot == Results.size())
+        {
+          error::print("unknown result name in [[...]]");
+          return 0;
+        }
+      }
+
+      if (Values[Slot])
+      {
+        error::print("result given twice in [[...]]");
+        return 0;
+      }
+
+      Values[Slot] = Elements[i].second->Codegen();
+      if (Values[Slot] == 0)
+        return 0;
+    }
+
+    debug_manager::get_instance()->emitLocation(this);
+
+    llvm::Value *Agg = llvm::UndefValue::get( Proto->getReturnType() );
+    for (unsigned r = 0; r != Results.size(); ++r)
+    {
+      llvm::Value *V = Values[r];
+      if (V == 0)
+        V = llvm::ConstantFP::get( compilation_context::current()->get_llvm_context(), llvm::APFloat( Proto->getResultDefaults()[r] ) );
+      Agg = builder_manager::get_instance()->get_ir()->CreateInsertValue(Agg, V, r, Results[r].c_str());
+    }
+    return Agg;
+  }
+
+};
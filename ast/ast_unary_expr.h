@@ -17,21 +17,35 @@ public:
     Operand->dump(out, ind + 1);
   }
 
+  bool CanRun() override
+  {
+    return Operand->CanRun() && evaluator::get_instance()->can_call(vsx_string<>("unary") + Opcode, 1);
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    std::vector<double> Args(1);
+    if (!Operand->Evaluate(Args[0]))
+      return false;
+
+    return evaluator::get_instance()->call(vsx_string<>("unary") + Opcode, Args, Result);
+  }
+
   llvm::Value* Codegen() override
   {
     llvm::Value *OperandV = Operand->Codegen();
     if (OperandV == 0)
       return 0;
 
-    llvm::Function *F = module_manager::get_instance()->get()->getFunction(std::string("unary") + Opcode);
-    if (F == 0)
+    ast_function_prototype *P = function_registry::get_instance()->get_prototype(vsx_string<>("unary") + Opcode);
+    if (P == 0)
     {
       error::print("Unknown unary operator");
       return 0;
     }
 
     debug_manager::get_instance()->emitLocation(this);
-    return builder_manager::get_instance()->get_ir()->CreateCall(F, OperandV, "unop");
+    return P->CodegenCall(OperandV, "unop");
   }
 
 };
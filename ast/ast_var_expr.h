@@ -1,30 +1,143 @@
 /// ast_var_expr - Expression class for var/in
 class ast_var_expr : public ast_expr {
   std::vector<std::pair<vsx_string<>, ast_expr *> > VarNames;
+  std::vector<uint64_t> ArraySizes; // 0 for scalars, one entry per VarNames
   ast_expr *Body;
 
 public:
   ast_var_expr(const std::vector<std::pair<vsx_string<>, ast_expr *> > &varnames,
+             const std::vector<uint64_t> &arraysizes,
              ast_expr *body)
-      : VarNames(varnames), Body(body) {}
+      : VarNames(varnames), ArraySizes(arraysizes), Body(body) {}
 
   void dump(vsx_string<char> &out, int ind) override
   {
-  out += "var";
+    out += "var";
     ast_expr::dump(out, ind);
-    for (const auto &NamedVar : VarNames)
+    for (size_t i = 0; i < VarNames.size(); i++)
     {
-      out += indent(out, ind) + NamedVar.first + ":";
+      const auto &NamedVar = VarNames[i];
+      indent(out, ind) += NamedVar.first;
+      if (ArraySizes[i])
+        out += "[" + vsx_string_helper::i2s((int)ArraySizes[i]) + "]";
+      out += ":";
 
-      NamedVar.second->dump(out, ind + 1);
+      if (NamedVar.second)
+        NamedVar.second->dump(out, ind + 1);
+      else
+        out += "null\n";
     }
-    out += indent(out, ind) + "Body:";
+    indent(out, ind) += "Body:";
     Body->dump( out, ind + 1);
   }
 
+  bool CanRun() override
+  {
+    for (const auto &Var : VarNames)
+      if (Var.second && !Var.second->CanRun())
+        return false;
+    return Body->CanRun();
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    evaluator *E = evaluator::get_instance();
+    auto &Arrays = E->get_arrays();
+
+    std::vector<evaluator::binding> OldBindings;
+    std::vector<std::pair<bool, std::vector<double> > > OldArrays;
+    bool Ok = true;
+    unsigned i = 0;
+    for (unsigned e = VarNames.size(); i != e && Ok; ++i) {
+      double InitVal = 0.0;
+      if (VarNames[i].second && !VarNames[i].second->Evaluate(InitVal))
+      {
+        Ok = false;
+        break;
+      }
+
+      const vsx_string<> &VarName = VarNames[i].first;
+      if (ArraySizes[i])
+      {
+        bool Had = Arrays.find(VarName) != Arrays.end();
+        OldArrays.push_back(std::make_pair(Had, Had ? Arrays[VarName] : std::vector<double>()));
+        Arrays[VarName] = std::vector<double>(ArraySizes[i], InitVal);
+        OldBindings.push_back(evaluator::binding());
+      }
+      else
+      {
+        OldArrays.push_back(std::make_pair(false, std::vector<double>()));
+        OldBindings.push_back(E->bind(VarName, InitVal));
+      }
+    }
+
+    if (Ok)
+      Ok = Body->Evaluate(Result);
+
+    // Pop the variables that were bound, in reverse.
+    while (i-- > 0)
+    {
+      const vsx_string<> &VarName = VarNames[i].first;
+      if (!ArraySizes[i])
+        E->restore(VarName, OldBindings[i]);
+      else if (OldArrays[i].first)
+        Arrays[VarName] = OldArrays[i].second;
+      else
+        Arrays.erase(VarName);
+    }
+    return Ok;
+  }
+
+  /// CodegenArray - Allocate a fixed size array and fill it with the
+  /// initializer, or zero it if there is none.
+  bool CodegenArray
+  (
+    llvm::Function *TheFunction,
+    const vsx_string<> &VarName,
+    uint64_t Size,
+    ast_expr *Init,
+    std::vector< llvm::AllocaInst *> &OldArrayBindings
+  )
+  {
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    llvm::Type *Int64Ty = llvm::Type::getInt64Ty( compilation_context::current()->get_llvm_context() );
+
+    llvm::Value *InitVal = 0;
+    if (Init) {
+      InitVal = Init->Codegen();
+      if (InitVal == 0)
+        return false;
+    }
+
+    llvm::AllocaInst *Alloca = llvm_helper::CreateEntryBlockArrayAlloca(TheFunction, std::string(VarName.c_str()), Size);
+
+    if (InitVal)
+    {
+      counted_loop Loop;
+      llvm::Value *Idx = Loop.begin( llvm::ConstantInt::get(Int64Ty, Size), "fill" );
+      llvm::Value *Ops[] = { llvm::ConstantInt::get(Int64Ty, 0), Idx };
+      Builder->CreateAlignedStore( InitVal, Builder->CreateInBoundsGEP(Alloca, Ops, "fillelt"), sizeof(double) );
+      loop_hints Hints;
+      Hints.vectorize = true;
+      Loop.end( Hints.get_loop_id() );
+    }
+    else
+      Builder->CreateMemSet(
+            Alloca,
+            llvm::ConstantInt::get( llvm::Type::getInt8Ty( compilation_context::current()->get_llvm_context() ), 0 ),
+            Size * sizeof(double),
+            Alloca->getAlignment()
+          );
+
+    OldArrayBindings.push_back( named_values::get_instance()->get_array( VarName ) );
+    named_values::get_instance()->set_array( VarName, Alloca );
+    return true;
+  }
+
   llvm::Value *Codegen() override
   {
     std::vector< llvm::AllocaInst *> OldBindings;
+    std::vector< llvm::AllocaInst *> OldArrayBindings;
 
     llvm::Function *TheFunction = builder_manager::get_instance()->get_ir()->GetInsertBlock()->getParent();
 
@@ -33,6 +146,15 @@ public:
       const vsx_string<> &VarName = VarNames[i].first;
       ast_expr *Init = VarNames[i].second;
 
+      if (ArraySizes[i])
+      {
+        if (!CodegenArray(TheFunction, VarName, ArraySizes[i], Init, OldArrayBindings))
+          return 0;
+        OldBindings.push_back(0);
+        continue;
+      }
+      OldArrayBindings.push_back(0);
+
       // Emit the initializer before adding the variable to scope, this prevents
       // the initializer from referencing the variable itself, and permits stuff
       // like this:
@@ -44,7 +166,7 @@ public:
         if (InitVal == 0)
           return 0;
       } else { // If not specified, use 0.0.
-        InitVal = llvm::ConstantFP::get( llvm::getGlobalContext(), llvm::APFloat(0.0));
+        InitVal = llvm::ConstantFP::get( compilation_context::current()->get_llvm_context(), llvm::APFloat(0.0));
       }
 
       llvm::AllocaInst *Alloca = llvm_helper::CreateEntryBlockAlloca(TheFunction, std::string(VarName.c_str()) );
@@ -67,7 +189,12 @@ public:
 
     // Pop all our variables from scope.
     for (unsigned i = 0, e = VarNames.size(); i != e; ++i)
-      named_values::get_instance()->set( VarNames[i].first, OldBindings[i] );
+    {
+      if (ArraySizes[i])
+        named_values::get_instance()->set_array( VarNames[i].first, OldArrayBindings[i] );
+      else
+        named_values::get_instance()->set( VarNames[i].first, OldBindings[i] );
+    }
 
     // Return the body computation.
     return BodyVal;
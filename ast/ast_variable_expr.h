@@ -17,12 +17,57 @@ public:
     ast_expr::dump(out, ind);
   }
 
+  llvm::Value *CodegenAddress() override
+  {
+    return named_values::get_instance()->get(Name);
+  }
+
+  llvm::Value *CodegenIndex() override
+  {
+    // foreach index variables are already integers, use them directly so the
+    // loop vectorizer sees a plain induction variable. A variable bound
+    // inside the loop shadows the index, same lookup order as Codegen.
+    if (!named_values::get_instance()->get(Name) && !named_values::get_instance()->get_value(Name))
+      if (llvm::Value *Index = named_values::get_instance()->get_index(Name))
+        return Index;
+
+    return ast_expr::CodegenIndex();
+  }
+
+  double *EvaluateAddress() override
+  {
+    return evaluator::get_instance()->get_address(Name);
+  }
+
+  bool CanRun() override
+  {
+    return true;
+  }
+
+  bool Evaluate(double &Result) override
+  {
+    return evaluator::get_instance()->get(Name, Result);
+  }
+
   llvm::Value *Codegen() override
   {
     // Look this variable up in the function.
     llvm::Value *V = named_values::get_instance()->get(Name);
     if (V == 0)
     {
+      if (llvm::Value *Value = named_values::get_instance()->get_value(Name))
+        return Value;
+
+      if (llvm::Value *Index = named_values::get_instance()->get_index(Name))
+      {
+        debug_manager::get_instance()->emitLocation(this);
+        return builder_manager::get_instance()->get_ir()->CreateSIToFP(
+              Index,
+              llvm::Type::getDoubleTy( compilation_context::current()->get_llvm_context() ),
+              Name.c_str()
+            );
+      }
+
       error::print("Unknown variable name");
       return 0;
     }
@@ -0,0 +1,227 @@
+// kbench - End to end benchmarks of generated code.
+//
+// Runs every program of the corpus through toy at -O0 .. -O3 and measures,
+// from the timings toy prints for each top-level expression:
+//
+//   compile  time to get the first call running: code generation and JIT of
+//            the expression and of every function it reaches (first call
+//            minus a steady state run)
+//   first    wall time of the first call, compilation included
+//   steady   fastest run of the later calls, all code compiled
+//
+// Each program ends in the same top-level call repeated a few times. toy runs
+// with -fno-tiering -fno-eval -jobs=0, so every call runs compiled code and
+// compilation happens on the first call. The best of -runs=N runs counts.
+//
+// Results are compared against a stored baseline, a regression is a metric
+// that got slower by more than -threshold=PCT percent (and by more than
+// 0.5 ms, below that it is noise). kbench exits with 1 on regressions.
+//
+//   kbench [-toy=PATH] [-corpus=DIR] [-baseline=FILE] [-runs=N]
+//          [-threshold=PCT] [-write-baseline]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+static const char *corpus[] = { "fib", "loops", "mandel", "operators", "reduction",
+                                 "reduction_fastmath", "scopes" };
+
+struct result
+{
+  double compile;
+  double first;
+  double steady;
+};
+
+/// run - Run one program once at opt_level, false if toy failed or printed
+/// no timings.
+static bool run(const std::string &toy, const std::string &path, unsigned opt_level, result &r)
+{
+  // toy prints its timings to stderr, the program output goes to stdout.
+  std::string command = toy + " -O" + std::to_string((long long)opt_level) +
+                        " -fno-tiering -fno-eval -jobs=0 " + path + " 2>&1 >/dev/null";
+  FILE *p = popen(command.c_str(), "r");
+  if (!p)
+    return false;
+
+  std::vector<double> totals, runs;
+  char line[1024];
+  while (fgets(line, sizeof(line), p))
+  {
+    double value, total, codegen, jit, run_ms;
+    if (sscanf(line, "Evaluated to %lf in %lf ms (codegen %lf ms, jit %lf ms, run %lf ms)",
+               &value, &total, &codegen, &jit, &run_ms) == 5)
+    {
+      totals.push_back(total);
+      runs.push_back(run_ms);
+    }
+  }
+  if (pclose(p) != 0 || totals.size() < 2)
+    return false;
+
+  r.first = totals[0];
+  r.steady = runs[1];
+  for (size_t i = 2; i < runs.size(); i++)
+    if (runs[i] < r.steady)
+      r.steady = runs[i];
+  r.compile = r.first > r.steady ? r.first - r.steady : 0;
+  return true;
+}
+
+static std::string key(const std::string &program, unsigned opt_level)
+{
+  return program + " O" + std::to_string((long long)opt_level);
+}
+
+static bool load_baseline(const char *path, std::map<std::string, result> &baseline)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+
+  char line[256];
+  while (fgets(line, sizeof(line), f))
+  {
+    char program[64];
+    unsigned opt_level;
+    result r;
+    if (line[0] != '#' &&
+        sscanf(line, "%63s O%u %lf %lf %lf", program, &opt_level, &r.compile, &r.first, &r.steady) == 5)
+      baseline[key(program, opt_level)] = r;
+  }
+  fclose(f);
+  return true;
+}
+
+static bool write_baseline(const char *path, const std::vector<std::string> &keys,
+                           std::map<std::string, result> &results)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+
+  fprintf(f, "# program level compile_ms first_ms steady_ms\n");
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    const result &r = results[keys[i]];
+    fprintf(f, "%s %.3f %.3f %.3f\n", keys[i].c_str(), r.compile, r.first, r.steady);
+  }
+  return !fclose(f);
+}
+
+/// compare - Print the change of one metric, true if it regressed.
+static bool compare(const char *metric, double now, double base, double threshold)
+{
+  double change = base > 0 ? (now - base) / base * 100 : 0;
+  bool regressed = change > threshold && now - base > 0.5;
+  printf("  %s %+6.1f%%%s", metric, change, regressed ? " REGRESSION" : "");
+  return regressed;
+}
+
+int main(int argc, char **argv)
+{
+  std::string toy = "./toy";
+  std::string corpus_dir = "bench";
+  std::string baseline_path;
+  unsigned runs = 3;
+  double threshold = 10;
+  bool write = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (!strncmp(arg, "-toy=", 5))
+      toy = arg + 5;
+    else if (!strncmp(arg, "-corpus=", 8))
+      corpus_dir = arg + 8;
+    else if (!strncmp(arg, "-baseline=", 10))
+      baseline_path = arg + 10;
+    else if (!strncmp(arg, "-runs=", 6))
+      runs = atoi(arg + 6);
+    else if (!strncmp(arg, "-threshold=", 11))
+      threshold = atof(arg + 11);
+    else if (!strcmp(arg, "-write-baseline"))
+      write = true;
+    else
+    {
+      fprintf(stderr, "usage: %s [-toy=PATH] [-corpus=DIR] [-baseline=FILE] [-runs=N]\n"
+                      "       [-threshold=PCT] [-write-baseline]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (baseline_path.empty())
+    baseline_path = corpus_dir + "/baseline.txt";
+  if (!runs)
+    runs = 1;
+
+  std::map<std::string, result> baseline;
+  bool have_baseline = !write && load_baseline(baseline_path.c_str(), baseline);
+  if (!write && !have_baseline)
+    printf("No baseline in %s, record one with -write-baseline\n", baseline_path.c_str());
+
+  std::vector<std::string> keys;
+  std::map<std::string, result> results;
+  unsigned regressions = 0;
+  bool failed = false;
+
+  printf("%-24s %12s %12s %12s\n", "program", "compile ms", "first ms", "steady ms");
+  for (size_t p = 0; p < sizeof(corpus) / sizeof(corpus[0]); p++)
+  {
+    std::string path = corpus_dir + "/" + corpus[p] + ".ks";
+    for (unsigned opt_level = 0; opt_level <= 3; opt_level++)
+    {
+      std::string k = key(corpus[p], opt_level);
+
+      result best = { 0, 0, 0 };
+      bool ok = false;
+      for (unsigned i = 0; i < runs; i++)
+      {
+        result r;
+        if (!run(toy, path, opt_level, r))
+          break;
+        if (!ok || r.compile < best.compile) best.compile = r.compile;
+        if (!ok || r.first < best.first) best.first = r.first;
+        if (!ok || r.steady < best.steady) best.steady = r.steady;
+        ok = true;
+      }
+      if (!ok)
+      {
+        printf("%-24s failed\n", k.c_str());
+        failed = true;
+        continue;
+      }
+
+      keys.push_back(k);
+      results[k] = best;
+      printf("%-24s %12.3f %12.3f %12.3f", k.c_str(), best.compile, best.first, best.steady);
+
+      std::map<std::string, result>::iterator b = baseline.find(k);
+      if (b != baseline.end())
+      {
+        bool regressed = compare("compile", best.compile, b->second.compile, threshold);
+        regressed |= compare("first", best.first, b->second.first, threshold);
+        regressed |= compare("steady", best.steady, b->second.steady, threshold);
+        regressions += regressed;
+      }
+      printf("\n");
+    }
+  }
+
+  if (write)
+  {
+    if (!write_baseline(baseline_path.c_str(), keys, results))
+    {
+      fprintf(stderr, "Could not write %s\n", baseline_path.c_str());
+      return 2;
+    }
+    printf("Baseline written to %s\n", baseline_path.c_str());
+  }
+
+  if (regressions)
+    printf("%u regressions over %.1f%%\n", regressions, threshold);
+  return failed ? 2 : regressions ? 1 : 0;
+}
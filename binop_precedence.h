@@ -1,6 +1,8 @@
 #ifndef BINOP_PRECEDENCE_H
 #define BINOP_PRECEDENCE_H
 
+#include "compilation_context.h"
+
 
 class binop
 {
@@ -40,8 +42,7 @@ public:
 
   static binop* get_instance()
   {
-    static binop b;
-    return &b;
+    return compilation_context::current()->get<binop>(compilation_context::c_binop);
   }
 
 };
@@ -1,2 +1,8 @@
-clang++-3.6 -g toy.cpp `llvm-config-3.6 --cxxflags --ldflags --system-libs --libs core mcjit native` -O3 -o toy
+clang++-3.6 -g -pthread toy.cpp `llvm-config-3.6 --cxxflags --ldflags --system-libs --libs core mcjit native scalaropts vectorize ipo bitreader bitwriter debuginfodwarf` -O3 -o toy
 
+# Runtime for ahead of time compiled programs (./toy -o prog.o).
+cc -O2 -c runtime/kaleidoscope_runtime.c runtime/kaleidoscope_main.c
+ar rcs libkaleidoscope_runtime.a kaleidoscope_runtime.o kaleidoscope_main.o
+
+# Benchmarks of generated code (./kbench, baseline in bench/baseline.txt).
+c++ -std=c++11 -O2 bench/kbench.cpp -o kbench
@@ -1,13 +1,20 @@
 #ifndef BUILDER_MANAGER_H
 #define BUILDER_MANAGER_H
 
+#include "compilation_context.h"
+
 class builder_manager
 {
-  llvm::DIBuilder* di_builder;
-  llvm::IRBuilder<>* ir_builder;
+  llvm::DIBuilder* di_builder = 0;
+  llvm::IRBuilder<>* ir_builder = 0;
 
 public:
 
+  ~builder_manager()
+  {
+    delete ir_builder;
+  }
+
   void set_di(llvm::DIBuilder* n)
   {
     di_builder = n;
@@ -18,20 +25,34 @@ public:
     ir_builder = n;
   }
 
+  /// set_fast_math - Let the floating point operations built from here on be
+  /// reassociated, contracted and assumed free of NaNs and infinities, or
+  /// build them strict IEEE again.
+  void set_fast_math(bool on)
+  {
+    llvm::FastMathFlags FMF;
+    if (on)
+      FMF.setUnsafeAlgebra();
+    get_ir()->SetFastMathFlags(FMF);
+  }
+
   llvm::DIBuilder* get_di()
   {
     return di_builder;
   }
 
+  /// get_ir - The IR builder, created on first use in the context's
+  /// LLVMContext.
   llvm::IRBuilder<>* get_ir()
   {
+    if (!ir_builder)
+      ir_builder = new llvm::IRBuilder<>( compilation_context::current()->get_llvm_context() );
     return ir_builder;
   }
 
   static builder_manager* get_instance()
   {
-    static builder_manager bm;
-    return &bm;
+    return compilation_context::current()->get<builder_manager>(compilation_context::c_builder);
   }
 };
 
@@ -0,0 +1,185 @@
+#ifndef CLASS_LAYOUT_H
+#define CLASS_LAYOUT_H
+
+#include <algorithm>
+#include "llvm_includes.h"
+#include "vsx_string.h"
+#include "vsx_string_helper.h"
+#include "compilation_context.h"
+
+/// class_field - One data member of a class, with its computed placement.
+struct class_field
+{
+  vsx_string<> name;
+  vsx_string<> type_name;
+  uint64_t count = 1;       // element count, > 1 for "m f32[16]"
+  uint64_t size = 0;        // bytes per element
+  uint64_t alignment = 1;   // natural alignment in bytes
+  uint64_t offset = 0;      // computed by class_layout::compute
+  llvm::Type* type = 0;
+  bool has_default = false;
+  double default_value = 0.0;
+};
+
+/// class_layout - Memory layout of a class, computed by the compiler from its
+/// fields and options:
+///
+///   pack           - no padding between fields (alignment 1)
+///   reorder        - sort fields by decreasing alignment to minimize padding
+///   align_bytes N  - align the class (and round its size) to N bytes
+class class_layout
+{
+  static uint64_t align_to(uint64_t value, uint64_t alignment)
+  {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+public:
+
+  vsx_string<> name;
+  std::vector<class_field> fields;
+  bool pack = false;
+  bool reorder = false;
+  uint64_t align_bytes = 0;
+
+  uint64_t size = 0;
+  uint64_t alignment = 1;
+  llvm::StructType* type = 0;
+
+  /// scalar_type - Look up a builtin scalar type (i1..i128, ui1..ui128,
+  /// f16..f128, iterator) and fill in its llvm type, size and alignment.
+  static bool scalar_type(const vsx_string<> &type_name, class_field &f)
+  {
+    llvm::LLVMContext &Context = compilation_context::current()->get_llvm_context();
+    const char* t = type_name.c_str();
+
+    if (type_name == "iterator")
+    {
+      f.type = llvm::Type::getInt64Ty(Context);
+      f.size = f.alignment = 8;
+      return true;
+    }
+
+    if (t[0] == 'f')
+    {
+      int bits = atoi(t + 1);
+      switch (bits)
+      {
+        case 16: f.type = llvm::Type::getHalfTy(Context); f.size = 2; break;
+        case 32: f.type = llvm::Type::getFloatTy(Context); f.size = 4; break;
+        case 64: f.type = llvm::Type::getDoubleTy(Context); f.size = 8; break;
+        case 80: f.type = llvm::Type::getX86_FP80Ty(Context); f.size = 16; break;
+        case 128: f.type = llvm::Type::getFP128Ty(Context); f.size = 16; break;
+        default: return false;
+      }
+      f.alignment = f.size;
+      return true;
+    }
+
+    int skip = 0;
+    if (t[0] == 'i')
+      skip = 1;
+    if (t[0] == 'u' && t[1] == 'i')
+      skip = 2;
+    if (!skip)
+      return false;
+
+    int bits = atoi(t + skip);
+    if (bits < 1 || bits > 128 || (bits & (bits - 1)))
+      return false;
+
+    // Sub-byte integers still occupy a whole byte.
+    f.size = bits < 8 ? 1 : bits / 8;
+    f.alignment = f.size;
+    f.type = llvm::IntegerType::get(Context, f.size * 8);
+    return true;
+  }
+
+  /// compute - Place the fields and build the llvm type. The struct is
+  /// emitted packed with explicit padding so the target data layout cannot
+  /// move anything around.
+  void compute()
+  {
+    llvm::LLVMContext &Context = compilation_context::current()->get_llvm_context();
+
+    if (reorder)
+      std::stable_sort(fields.begin(), fields.end(),
+        [](const class_field &a, const class_field &b)
+        {
+          if (a.alignment != b.alignment)
+            return a.alignment > b.alignment;
+          return a.size * a.count > b.size * b.count;
+        }
+      );
+
+    std::vector<llvm::Type*> elements;
+    uint64_t offset = 0;
+    alignment = 1;
+    for (class_field &f : fields)
+    {
+      uint64_t field_alignment = pack ? 1 : f.alignment;
+      uint64_t aligned = align_to(offset, field_alignment);
+      if (aligned != offset)
+        elements.push_back( llvm::ArrayType::get( llvm::Type::getInt8Ty(Context), aligned - offset ) );
+
+      f.offset = aligned;
+      if (f.count > 1)
+        elements.push_back( llvm::ArrayType::get(f.type, f.count) );
+      else
+        elements.push_back( f.type );
+
+      offset = aligned + f.size * f.count;
+      alignment = std::max(alignment, field_alignment);
+    }
+
+    if (align_bytes)
+      alignment = std::max(alignment, align_bytes);
+
+    size = align_to(offset, alignment);
+    if (size != offset)
+      elements.push_back( llvm::ArrayType::get( llvm::Type::getInt8Ty(Context), size - offset ) );
+
+    type = llvm::StructType::create(Context, elements, std::string("class.") + name.c_str(), true);
+  }
+
+  void dump(vsx_string<char> &out)
+  {
+    out += "class " + name + " size " + vsx_string_helper::i2s((int)size) + " align " + vsx_string_helper::i2s((int)alignment) + "\n";
+    for (class_field &f : fields)
+    {
+      out += "  " + vsx_string_helper::i2s((int)f.offset) + ": " + f.name + " " + f.type_name;
+      if (f.count > 1)
+        out += "[" + vsx_string_helper::i2s((int)f.count) + "]";
+      if (f.has_default)
+        out += " = " + vsx_string_helper::f2s(f.default_value);
+      out += "\n";
+    }
+  }
+};
+
+/// class_registry - All classes declared so far, by name.
+class class_registry
+{
+  std::map<vsx_string<>, class_layout*> classes;
+
+public:
+
+  void add(class_layout* c)
+  {
+    classes[c->name] = c;
+  }
+
+  class_layout* get(vsx_string<> name)
+  {
+    if (classes.find(name) == classes.end())
+      return 0;
+    return classes[name];
+  }
+
+  static class_registry* get_instance()
+  {
+    return compilation_context::current()->get<class_registry>(compilation_context::c_classes);
+  }
+};
+
+#endif
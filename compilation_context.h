@@ -0,0 +1,158 @@
+#ifndef COMPILATION_CONTEXT_H
+#define COMPILATION_CONTEXT_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "llvm_includes.h"
+
+/// compilation_context - Everything one program is compiled with: its own
+/// LLVMContext, and the state behind the front end singletons (module and
+/// builders, symbol table, precedence table, lexer and source, registries,
+/// debug info and evaluator).
+///
+/// The singletons resolve through the context that is current on the calling
+/// thread, so code keeps using X::get_instance() and several programs can be
+/// compiled at once, one per thread:
+///
+///   compilation_context Context;
+///   compilation_context::scope Scope(&Context);
+///   ... parse and generate code ...
+///
+/// Threads without a context of their own use the default one, which is built
+/// on llvm::getGlobalContext().
+///
+/// The JIT is shared by the whole process and runs the code of every context.
+/// Function names are per context, so each context other than the default
+/// one prefixes the symbols it generates ("ctx1.fib"); host functions keep
+/// their own names. The context's mutex guards its LLVMContext: the thread
+/// generating code holds it from jit_engine::begin_module to end_module, and
+/// the JIT takes it before compiling the context's IR from another thread.
+class compilation_context
+{
+public:
+
+  /// component - The per program state, created on first use.
+  enum component
+  {
+    c_module,
+    c_builder,
+    c_named_values,
+    c_binop,
+    c_parser,
+    c_source,
+    c_functions,
+    c_classes,
+    c_debug,
+    c_evaluator,
+    c_aot,
+    c_tiering,
+    c_pgo,
+    c_count
+  };
+
+  /// scope - Make a context current on this thread for the lifetime of the
+  /// scope.
+  class scope
+  {
+    compilation_context *previous;
+
+  public:
+
+    scope(compilation_context *context)
+      : previous(current_slot())
+    {
+      current_slot() = context;
+    }
+
+    ~scope()
+    {
+      current_slot() = previous;
+    }
+  };
+
+private:
+
+  // Declared before the components, which refer to it, so it is destroyed
+  // after them.
+  std::unique_ptr<llvm::LLVMContext> owned_llvm_context;
+  llvm::LLVMContext *llvm_context;
+
+  std::string symbol_prefix;
+  std::recursive_mutex mutex;
+
+  std::shared_ptr<void> components[c_count];
+
+  static compilation_context *&current_slot()
+  {
+    static thread_local compilation_context *context = 0;
+    return context;
+  }
+
+  struct use_global_context {};
+
+  compilation_context(use_global_context)
+    : llvm_context(&llvm::getGlobalContext())
+  {
+  }
+
+public:
+
+  compilation_context()
+    : owned_llvm_context(new llvm::LLVMContext),
+      llvm_context(owned_llvm_context.get())
+  {
+    static std::atomic<unsigned> count(0);
+    symbol_prefix = "ctx" + std::to_string((unsigned long long)++count) + ".";
+  }
+
+  compilation_context(const compilation_context &) = delete;
+  compilation_context &operator=(const compilation_context &) = delete;
+
+  llvm::LLVMContext &get_llvm_context()
+  {
+    return *llvm_context;
+  }
+
+  /// get_symbol_prefix - Prefix of the symbols generated in this context,
+  /// empty for the default context.
+  const std::string &get_symbol_prefix()
+  {
+    return symbol_prefix;
+  }
+
+  std::recursive_mutex &get_mutex()
+  {
+    return mutex;
+  }
+
+  /// get - The component id of type T, created on first use. The
+  /// shared_ptr keeps the right deleter, so this header only needs T to be
+  /// complete where it is instantiated.
+  template <class T>
+  T *get(component id)
+  {
+    std::shared_ptr<void> &c = components[id];
+    if (!c)
+      c = std::make_shared<T>();
+    return static_cast<T *>(c.get());
+  }
+
+  static compilation_context *get_default()
+  {
+    static compilation_context context((use_global_context()));
+    return &context;
+  }
+
+  /// current - The context of the calling thread.
+  static compilation_context *current()
+  {
+    if (compilation_context *context = current_slot())
+      return context;
+    return get_default();
+  }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef COUNTED_LOOP_H
+#define COUNTED_LOOP_H
+
+#include "llvm_includes.h"
+#include "builder_manager.h"
+
+/// counted_loop - Emits a canonical loop running an i64 induction variable
+/// from 0 to Count - 1:
+///
+///   guard:
+///     br (count != 0), preheader, after
+///   preheader:
+///     br loop
+///   loop:
+///     idx = phi [0, preheader], [next, latch]
+///     ...body...
+///   latch:
+///     next = idx + 1
+///     br (next < count), loop, exit     ; !llvm.loop
+///   exit:
+///     br after
+///   after:
+class counted_loop
+{
+  llvm::Value* Count = 0;
+  llvm::PHINode* Index = 0;
+  llvm::BasicBlock* GuardBB = 0;
+  llvm::BasicBlock* LoopBB = 0;
+  llvm::BasicBlock* ExitBB = 0;
+  llvm::BasicBlock* AfterBB = 0;
+
+public:
+
+  /// begin - Emit the guard, preheader and loop header at the current insert
+  /// point and leave the builder positioned at the start of the body.
+  /// Returns the induction variable.
+  llvm::Value* begin(llvm::Value* count, const char* name)
+  {
+    llvm::IRBuilder<>* Builder = builder_manager::get_instance()->get_ir();
+    llvm::LLVMContext &Context = compilation_context::current()->get_llvm_context();
+    llvm::Type* Int64Ty = llvm::Type::getInt64Ty(Context);
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+    Count = count;
+    GuardBB = Builder->GetInsertBlock();
+
+    llvm::BasicBlock *PreheaderBB = llvm::BasicBlock::Create(Context, std::string(name) + "ph", TheFunction);
+    LoopBB = llvm::BasicBlock::Create(Context, std::string(name) + "loop", TheFunction);
+    ExitBB = llvm::BasicBlock::Create(Context, std::string(name) + "exit");
+    AfterBB = llvm::BasicBlock::Create(Context, std::string(name) + "after");
+
+    llvm::Value* NonEmpty = Builder->CreateICmpNE(Count, llvm::ConstantInt::get(Int64Ty, 0), "nonempty");
+    Builder->CreateCondBr(NonEmpty, PreheaderBB, AfterBB);
+
+    Builder->SetInsertPoint(PreheaderBB);
+    Builder->CreateBr(LoopBB);
+
+    Builder->SetInsertPoint(LoopBB);
+    Index = Builder->CreatePHI(Int64Ty, 2, std::string(name) + "idx");
+    Index->addIncoming(llvm::ConstantInt::get(Int64Ty, 0), PreheaderBB);
+    return Index;
+  }
+
+  /// end - Emit the latch at the current insert point (the end of the body)
+  /// and continue insertion in the after block.
+  void end(llvm::MDNode* LoopID)
+  {
+    llvm::IRBuilder<>* Builder = builder_manager::get_instance()->get_ir();
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+    llvm::Value* Next = Builder->CreateAdd(Index, llvm::ConstantInt::get(Index->getType(), 1), "next", true, true);
+    llvm::Value* Cond = Builder->CreateICmpULT(Next, Count, "loopcond");
+
+    // The body may have created new blocks, the latch is wherever it ended.
+    llvm::BasicBlock* LatchBB = Builder->GetInsertBlock();
+    llvm::BranchInst* Latch = Builder->CreateCondBr(Cond, LoopBB, ExitBB);
+    if (LoopID)
+      Latch->setMetadata("llvm.loop", LoopID);
+    Index->addIncoming(Next, LatchBB);
+
+    TheFunction->getBasicBlockList().push_back(ExitBB);
+    Builder->SetInsertPoint(ExitBB);
+    Builder->CreateBr(AfterBB);
+
+    TheFunction->getBasicBlockList().push_back(AfterBB);
+    Builder->SetInsertPoint(AfterBB);
+  }
+
+  llvm::BasicBlock* get_guard_block()
+  {
+    return GuardBB;
+  }
+
+  llvm::BasicBlock* get_exit_block()
+  {
+    return ExitBB;
+  }
+};
+
+#endif
@@ -6,98 +6,157 @@
 #include "ast/ast_function_prototype.h"
 #include "ast/ast_expr.h"
 #include "builder_manager.h"
+#include "source.h"
 
 using namespace llvm;
 
 class debug_info
     : public debug_abs
 {
-  llvm::DICompileUnit *TheCU;
+  // Per module; the compile unit, file and types are created once per
+  // module and reused by all functions in it.
+  llvm::DICompileUnit TheCU;
+  llvm::DIFile File;
   llvm::DIType DblTy;
-  std::vector<llvm::DIScope *> LexicalBlocks;
-  std::map< const ast_function_prototype *, llvm::DIScope *> FnScopeMap;
+  std::map<unsigned, llvm::DISubroutineType> FunctionTypes; // by number of args
 
-public:
+  std::vector<llvm::DIScope> LexicalBlocks;
 
-  void init()
+  // Subprograms of functions whose body is not generated yet.
+  std::map< const ast_function_prototype *, llvm::DISubprogram> FnScopeMap;
+
+  DIBuilder *getDI()
   {
-    TheCU = new DICompileUnit();
-    *TheCU = builder_manager::get_instance()->get_di()->createCompileUnit(
-        dwarf::DW_LANG_C, "fib.ks", ".", "Kaleidoscope Compiler", 0, "", 0);
+    return builder_manager::get_instance()->get_di();
   }
 
-  llvm::DICompileUnit* getCU()
+  DIFile getFile()
   {
-    return TheCU;
+    if (!File)
+      File = getDI()->createFile(TheCU.getFilename(), TheCU.getDirectory());
+    return File;
   }
 
-  void addFunctionScopeMap(void* proto, llvm::DIScope* scope)
+  DIType getDoubleTy()
   {
-    ast_function_prototype* p = static_cast<ast_function_prototype*>(proto);
-    if (p)
-      FnScopeMap[p] = scope;
+    if (!DblTy)
+      DblTy = getDI()->createBasicType("double", 64, 64, dwarf::DW_ATE_float);
+    return DblTy;
   }
 
-  void addFunctionScopeToLexicalBlocks(void* proto)
+  DISubroutineType getFunctionType(unsigned NumArgs)
   {
-    ast_function_prototype* p = static_cast<ast_function_prototype*>(proto);
-    if (p)
-      LexicalBlocks.push_back(FnScopeMap[p]);
+    std::map<unsigned, DISubroutineType>::iterator it = FunctionTypes.find(NumArgs);
+    if (it != FunctionTypes.end())
+      return it->second;
+
+    SmallVector<Metadata *, 8> EltTys;
+
+    // Add the result type.
+    EltTys.push_back(getDoubleTy());
+
+    for (unsigned i = 0, e = NumArgs; i != e; ++i)
+      EltTys.push_back(getDoubleTy());
+
+    DISubroutineType Ty = getDI()->createSubroutineType(getFile(), getDI()->getOrCreateTypeArray(EltTys));
+    FunctionTypes[NumArgs] = Ty;
+    return Ty;
   }
 
-  void emitLocation(void *AST)
+public:
+
+  void init()
   {
-    if (!AST)
-      return builder_manager::get_instance()->get_ir()->SetCurrentDebugLocation(DebugLoc());
+    // Every module gets its own compile unit, so types are not shared.
+    File = DIFile();
+    DblTy = DIType();
+    FunctionTypes.clear();
+    LexicalBlocks.clear();
+    FnScopeMap.clear();
+
+    TheCU = getDI()->createCompileUnit(
+        dwarf::DW_LANG_C, source::get_instance()->get_name(), ".", "Kaleidoscope Compiler", 0, "", 0);
+  }
 
-    ast_expr* pAST = static_cast<ast_expr*>(AST);
+  void emitFunction(void* proto, llvm::Function *F, const char *Name, unsigned Line, unsigned NumArgs)
+  {
+    ast_function_prototype* p = static_cast<ast_function_prototype*>(proto);
 
+    // Create a subprogram DIE for this function.
+    unsigned LineNo = Line;
+    unsigned ScopeLine = Line;
+    DISubprogram SP = getDI()->createFunction(
+        getFile(),
+        Name,
+        StringRef(),
+        getFile(),
+        LineNo,
+        getFunctionType(NumArgs),
+        false /* internal linkage */,
+        true /* definition */,
+        ScopeLine,
+        DIDescriptor::FlagPrototyped,
+        false,
+        F
+      );
 
-    DIScope *Scope;
-    if (LexicalBlocks.empty())
-      Scope = TheCU;
-    else
-      Scope = LexicalBlocks.back();
-    builder_manager::get_instance()->get_ir()->SetCurrentDebugLocation(
-      DebugLoc::get(pAST->getLine(), pAST->getCol(), *Scope)
-    );
+    if (p)
+      FnScopeMap[p] = SP;
   }
 
-  DIType *getDoubleTy()
+  void emitArgument(llvm::AllocaInst *Alloca, const char *Name, unsigned Line, unsigned ArgNo)
   {
-    if (DblTy)
-      return &DblTy;
+    // Create a debug descriptor for the variable.
+    DIVariable D = getDI()->createLocalVariable(
+        dwarf::DW_TAG_arg_variable, LexicalBlocks.back(), Name, getFile(), Line,
+        getDoubleTy(), false, 0, ArgNo);
+
+    getDI()->insertDeclare(
+          Alloca,
+          D,
+          getDI()->createExpression(),
+          builder_manager::get_instance()->get_ir()->GetInsertBlock()
+          );
+  }
 
-    DblTy = builder_manager::get_instance()->get_di()->createBasicType("double", 64, 64, dwarf::DW_ATE_float);
-    return &DblTy;
+  void addFunctionScopeToLexicalBlocks(void* proto)
+  {
+    ast_function_prototype* p = static_cast<ast_function_prototype*>(proto);
+    if (!p)
+      return;
+
+    std::map< const ast_function_prototype *, DISubprogram>::iterator it = FnScopeMap.find(p);
+    if (it == FnScopeMap.end())
+    {
+      LexicalBlocks.push_back(DIScope());
+      return;
+    }
+    LexicalBlocks.push_back(it->second);
+    FnScopeMap.erase(it);
   }
 
-  std::vector<llvm::DIScope *>* getLexicalBlocks()
+  void removeFunctionScopeFromLexicalBlocks()
   {
-    return &LexicalBlocks;
+    LexicalBlocks.pop_back();
   }
 
-  DISubroutineType *CreateFunctionType(unsigned NumArgs, DIFile *Unit)
+  void emitLocation(void *AST)
   {
-    SmallVector<Metadata *, 8> EltTys;
-    DIType *DblTy = getDoubleTy();
+    if (!AST)
+      return builder_manager::get_instance()->get_ir()->SetCurrentDebugLocation(DebugLoc());
 
-    // Add the result type.
-    EltTys.push_back(*DblTy);
+    ast_expr* pAST = static_cast<ast_expr*>(AST);
 
-    for (unsigned i = 0, e = NumArgs; i != e; ++i)
-      EltTys.push_back(*DblTy);
 
-    DISubroutineType* dt = new DISubroutineType;
-    *dt = builder_manager::get_instance()->get_di()->createSubroutineType(
-          *Unit,
-          builder_manager::get_instance()->get_di()->getOrCreateTypeArray(EltTys)
+    DIScope Scope;
+    if (LexicalBlocks.empty())
+      Scope = TheCU;
+    else
+      Scope = LexicalBlocks.back();
+    builder_manager::get_instance()->get_ir()->SetCurrentDebugLocation(
+      DebugLoc::get(pAST->getLine(), pAST->getCol(), Scope)
     );
-
-    return dt;
   }
-
-
 };
 
 
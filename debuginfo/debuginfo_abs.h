@@ -4,19 +4,28 @@
 #include "llvm_includes.h"
 
 
-
+/// debug_abs - Debug info emission, as used by code generation. debug_info
+/// emits DWARF through the DIBuilder (-g, the default), debug_null does
+/// nothing (-g0).
 class debug_abs
 {
 public:
 
+  virtual ~debug_abs() {}
+
+  /// init - Start debug info for a new module.
   virtual void init() = 0;
   virtual void emitLocation(void *AST) = 0;
-  virtual llvm::DICompileUnit* getCU() = 0;
-  virtual llvm::DIType *getDoubleTy() = 0;
-  virtual llvm::DISubroutineType *CreateFunctionType(unsigned NumArgs, llvm::DIFile *Unit) = 0;
-  virtual std::vector<llvm::DIScope *>* getLexicalBlocks() = 0;
-  virtual void addFunctionScopeMap(void* proto, llvm::DIScope* scope) = 0;
+
+  /// emitFunction - Describe function F of prototype proto.
+  virtual void emitFunction(void* proto, llvm::Function *F, const char *Name, unsigned Line, unsigned NumArgs) = 0;
+
+  /// emitArgument - Describe argument ArgNo, stored in Alloca, of the
+  /// function on top of the lexical blocks.
+  virtual void emitArgument(llvm::AllocaInst *Alloca, const char *Name, unsigned Line, unsigned ArgNo) = 0;
+
   virtual void addFunctionScopeToLexicalBlocks(void* proto) = 0;
+  virtual void removeFunctionScopeFromLexicalBlocks() = 0;
 
 };
 
@@ -6,15 +6,15 @@
 #include <vector>
 
 #include "lex.h"
+#include "options.h"
 #include "debuginfo.h"
+#include "debuginfo_null.h"
 #include "debuginfo_manager.h"
 
 
-debug_info di;
-
-
 debug_abs* debug_manager::get_instance()
 {
-  return (debug_abs*)&di;
+  if (!options::get_instance()->get_debug_info())
+    return compilation_context::current()->get<debug_null>(compilation_context::c_debug);
+  return compilation_context::current()->get<debug_info>(compilation_context::c_debug);
 }
-
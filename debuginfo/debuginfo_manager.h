@@ -3,6 +3,7 @@
 
 #include "llvm_includes.h"
 #include "debuginfo_abs.h"
+#include "compilation_context.h"
 
 class debug_manager
 {
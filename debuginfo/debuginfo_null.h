@@ -0,0 +1,21 @@
+#ifndef VX_DEBUG_NULL_H
+#define VX_DEBUG_NULL_H
+
+#include "debuginfo_abs.h"
+
+/// debug_null - No debug info (-g0). Modules get no DIBuilder, and nothing
+/// is created or remembered per function, argument or expression.
+class debug_null
+    : public debug_abs
+{
+public:
+
+  void init() override {}
+  void emitLocation(void *AST) override {}
+  void emitFunction(void* proto, llvm::Function *F, const char *Name, unsigned Line, unsigned NumArgs) override {}
+  void emitArgument(llvm::AllocaInst *Alloca, const char *Name, unsigned Line, unsigned ArgNo) override {}
+  void addFunctionScopeToLexicalBlocks(void* proto) override {}
+  void removeFunctionScopeFromLexicalBlocks() override {}
+};
+
+#endif
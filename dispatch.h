@@ -1,15 +1,62 @@
 
 #include "parser.h"
 #include "ast/ast_parse.h"
+#include "jit/jit_engine.h"
+#include "aot/aot_compiler.h"
 
+#include <chrono>
+
+static double milliseconds_since(std::chrono::high_resolution_clock::time_point Start)
+{
+  return std::chrono::duration<double, std::milli>(
+      std::chrono::high_resolution_clock::now() - Start).count();
+}
+
+/// end_parse - End the parse phase of a top-level item, now that its name is
+/// known, and account the lexing done for it.
+static void end_parse(trace_scope &Parse, const char *Name)
+{
+  if (!trace::get_instance()->is_enabled() && !memory_stats::get_instance()->is_enabled())
+    return;
+  trace::get_instance()->set_item(Name);
+  Parse.end();
+  if (trace::get_instance()->is_enabled())
+    trace::get_instance()->record_lex(Parse.get_start());
+}
 
 static void HandleFunction() {
+  trace_scope Parse("parse");
   if (ast_function *F = parse_function())
   {
-    if (!F->Codegen())
+    end_parse(Parse, F->getProto()->getName().c_str());
+
+    // Ahead of time everything goes into the one program module.
+    if (options::get_instance()->get_output())
+    {
+      trace_scope Codegen("codegen");
+      if (!F->Codegen())
+        fprintf(stderr, "Error reading function definition:");
+      return;
+    }
+
+    // Each definition gets a module of its own, compiled in the background
+    // or on first call.
+    jit_engine::get_instance()->begin_module( F->getProto()->getName().c_str(),
+                                              !compile_pipeline::get_instance()->is_running() );
+    trace_scope Codegen("codegen");
+    llvm::Function *LF = F->Codegen();
+    Codegen.end();
+    llvm::Module *M = jit_engine::get_instance()->end_module();
+
+    if (!LF)
     {
       fprintf(stderr, "Error reading function definition:");
+      delete M;
+      return;
     }
+
+    jit_engine::get_instance()->add_definition(M, F->getProto()->getName().c_str(),
+                                               F->getProto()->getSymbolName().c_str());
   } else {
     // Skip token for error recovery.
     parser::get()->get_next_token();
@@ -18,10 +65,32 @@ static void HandleFunction() {
 
 
 static void HandleExtern() {
+  trace_scope Parse("parse");
   if (ast_function_prototype *P = ParseExtern()) {
-    if (!P->Codegen()) {
-      fprintf(stderr, "Error reading extern");
-    }
+    end_parse(Parse, P->getName().c_str());
+
+    // Declarations are emitted into each module that calls the extern.
+    // Host functions keep their own name in every context, externs defined
+    // later in the program get the context's prefix like any definition.
+    if (P->getSymbolName() != P->getName() && !options::get_instance()->get_output() &&
+        jit_engine::get_instance()->get_host_symbol(P->getName().c_str()))
+      P->setSymbolName(P->getName());
+    function_registry::get_instance()->set_prototype(P->getName(), P);
+  } else {
+    // Skip token for error recovery.
+    parser::get()->get_next_token();
+  }
+}
+
+static void HandleClass() {
+  if (class_layout *C = ParseClass()) {
+    C->compute();
+    class_registry::get_instance()->add(C);
+
+    vsx_string<> out;
+    C->dump(out);
+    printf("%s", out.c_str());
+    fflush(stdout);
   } else {
     // Skip token for error recovery.
     parser::get()->get_next_token();
@@ -29,20 +98,121 @@ static void HandleExtern() {
 }
 
 static void HandleTopLevelExpression() {
+  std::chrono::high_resolution_clock::time_point Submitted = std::chrono::high_resolution_clock::now();
+
   // Evaluate a top-level expression into an anonymous function.
+  trace_scope Parse("parse");
   if (ast_function *F = ParseTopLevelExpr()) {
-    if (!F->Codegen()) {
+    end_parse(Parse, F->getProto()->getName().c_str());
+
+    // Pure expressions are evaluated right away, no code is generated
+    // (ahead of time only the folded constant is).
+    double Result;
+    if (options::get_instance()->get_eval())
+    {
+      trace_scope Fold("fold");
+      evaluator::get_instance()->reset( options::get_instance()->get_eval_steps() );
+      bool Folded = F->getBody()->Evaluate(Result);
+      Fold.end();
+      if (Folded)
+      {
+        fprintf(stderr, "Folded top-level expression to %f in %.3f ms\n",
+                Result, milliseconds_since(Submitted));
+        if (!options::get_instance()->get_output())
+          return;
+        F = new ast_function(F->getProto(), new ast_number_expr(Result));
+      }
+    }
+
+    // Ahead of time the expression becomes an entry of kaleidoscope_main.
+    if (options::get_instance()->get_output())
+    {
+      trace_scope Codegen("codegen");
+      if (!F->Codegen())
+        fprintf(stderr, "Error generating code for top level expr\n");
+      else
+        aot_compiler::get_instance()->add_entry( F->getProto()->getName().c_str() );
+      return;
+    }
+
+    // Top-level expressions run once, interpret them. Hot callees are
+    // compiled in the background meanwhile. Expressions reaching anything
+    // the interpreter does not support are compiled right away, so nothing
+    // runs twice.
+    if (options::get_instance()->get_tiering() && F->getBody()->CanRun())
+    {
+      trace_scope Interpret("interpret");
+      evaluator::get_instance()->begin_run();
+      bool Interpreted = F->getBody()->Evaluate(Result);
+      evaluator::get_instance()->end_run();
+      Interpret.end();
+
+      if (Interpreted)
+      {
+        fprintf(stderr, "Interpreted to %f in %.3f ms\n", Result, milliseconds_since(Submitted));
+        return;
+      }
+
+      // Only failures CanRun cannot see get here, e.g. an index out of
+      // bounds. Running the compiled code would repeat the side effects
+      // before it.
+      if (evaluator::get_instance()->had_side_effects())
+      {
+        fprintf(stderr, "Interpreter gave up after side effects, not running top level expr again\n");
+        return;
+      }
+      fprintf(stderr, "Interpreter gave up, compiling top level expr\n");
+    }
+
+    jit_engine::get_instance()->begin_module( F->getProto()->getName().c_str() );
+    trace_scope Codegen("codegen");
+    llvm::Function *LF = F->Codegen();
+    Codegen.end();
+    llvm::Module *M = jit_engine::get_instance()->end_module();
+
+    if (!LF) {
       fprintf(stderr, "Error generating code for top level expr\n");
+      delete M;
+      return;
     }
+    double CodegenMs = milliseconds_since(Submitted);
+
+    // JIT the function, returning a function pointer. Callees are only
+    // compiled when they are first called.
+    trace_scope Jit("jit");
+    double (*FP)() = (double (*)())(intptr_t)
+        jit_engine::get_instance()->get_entry(M, F->getProto()->getSymbolName().c_str());
+    Jit.end();
+    if (!FP) {
+      fprintf(stderr, "Error compiling top level expr\n");
+      return;
+    }
+    double CompileMs = milliseconds_since(Submitted);
+
+    trace_scope Run("run");
+    Result = FP();
+    Run.end();
+    double TotalMs = milliseconds_since(Submitted);
+
+    // Nothing refers to a top-level expression once it has run.
+    jit_engine::get_instance()->release_entry(F->getProto()->getSymbolName().c_str());
+
+    fprintf(stderr, "Evaluated to %f in %.3f ms (codegen %.3f ms, jit %.3f ms, run %.3f ms)\n",
+            Result, TotalMs, CodegenMs, CompileMs - CodegenMs, TotalMs - CompileMs);
   } else {
     // Skip token for error recovery.
     parser::get()->get_next_token();
   }
 }
 
-/// top ::= definition | external | expression | ';'
+/// top ::= definition | external | class | expression | ';'
 static void MainLoop() {
   while (1) {
+    // No generated code runs between top-level items, so code replaced by
+    // redefinitions can be freed here.
+    if (!options::get_instance()->get_output())
+      jit_engine::get_instance()->collect();
+
     switch ( parser::get()->get_current_token() )
     {
       case tok_function:
@@ -53,6 +223,10 @@ static void MainLoop() {
         HandleExtern();
         break;
 
+      case tok_class:
+        HandleClass();
+        break;
+
       default:
         HandleTopLevelExpression();
         break;
@@ -0,0 +1,174 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <stdint.h>
+#include <set>
+#include "vsx_string.h"
+#include "compilation_context.h"
+
+/// evaluator - State of the AST interpreter (see ast_expr::Evaluate).
+///
+/// After reset() it folds pure top-level expressions at compile time:
+/// evaluation fails, and the caller falls back to code generation, as soon as
+/// anything impure (an extern), unknown or too expensive (step or call depth
+/// limit) is reached. Nothing observable happens during evaluation.
+///
+/// Between begin_run() and end_run() it is the baseline execution tier:
+/// there is no step budget, externs and compiled functions are called
+/// natively, and calls and loop back edges are counted to find hot functions
+/// (see tiering). Whether a top-level expression can be run this way is
+/// decided up front by ast_expr::CanRun, since a run that gives up halfway
+/// may already have called an extern.
+class evaluator
+{
+public:
+
+  /// binding - a saved variable binding, for restoring shadowed names.
+  struct binding
+  {
+    bool bound;
+    double value;
+  };
+
+private:
+
+  uint64_t steps_left = 0;
+  unsigned depth = 0;
+  unsigned max_depth = 256;
+  bool running = false;
+  bool side_effects = false; // native code was called during the run
+  vsx_string<> current; // function being interpreted, empty at top level
+
+  std::map<vsx_string<>, double> variables;
+  std::map<vsx_string<>, std::vector<double> > arrays;
+  std::map<vsx_string<>, size_t> cursors;
+
+  // functions whose bodies can_call is checking, for recursion
+  std::set<vsx_string<> > checking;
+
+public:
+
+  void reset(uint64_t max_steps)
+  {
+    steps_left = max_steps;
+    depth = 0;
+    max_depth = 256;
+    running = false;
+    side_effects = false;
+    current = "";
+    variables.clear();
+    arrays.clear();
+    cursors.clear();
+  }
+
+  /// begin_run - Switch to the execution tier for a top-level expression.
+  void begin_run()
+  {
+    reset(UINT64_MAX);
+    max_depth = 512;
+    running = true;
+  }
+
+  void end_run()
+  {
+    running = false;
+  }
+
+  bool is_running()
+  {
+    return running;
+  }
+
+  /// had_side_effects - Whether the last run called externs or compiled
+  /// code, so it cannot simply be done over.
+  bool had_side_effects()
+  {
+    return side_effects;
+  }
+
+  void set_side_effects(bool on)
+  {
+    side_effects = on;
+  }
+
+  /// step - Account for one unit of work, false when the budget is spent.
+  bool step()
+  {
+    if (!steps_left)
+      return false;
+    steps_left--;
+    return true;
+  }
+
+  bool get(const vsx_string<> &name, double &value)
+  {
+    auto it = variables.find(name);
+    if (it == variables.end())
+      return false;
+    value = it->second;
+    return true;
+  }
+
+  double* get_address(const vsx_string<> &name)
+  {
+    auto it = variables.find(name);
+    if (it == variables.end())
+      return 0;
+    return &it->second;
+  }
+
+  binding bind(const vsx_string<> &name, double value)
+  {
+    binding old;
+    old.bound = get(name, old.value);
+    variables[name] = value;
+    return old;
+  }
+
+  void restore(const vsx_string<> &name, const binding &old)
+  {
+    if (old.bound)
+      variables[name] = old.value;
+    else
+      variables.erase(name);
+  }
+
+  std::vector<double>* get_array(const vsx_string<> &name)
+  {
+    auto it = arrays.find(name);
+    if (it == arrays.end())
+      return 0;
+    return &it->second;
+  }
+
+  std::map<vsx_string<>, std::vector<double> > &get_arrays()
+  {
+    return arrays;
+  }
+
+  std::map<vsx_string<>, size_t> &get_cursors()
+  {
+    return cursors;
+  }
+
+  /// call - Evaluate a call to a user defined function. Defined next to
+  /// ast_function, which it needs.
+  bool call(const vsx_string<> &name, std::vector<double> &args, double &result);
+
+  /// can_call - Whether the execution tier can run a call to name with args
+  /// arguments: a known extern or a function whose body CanRun, taking at
+  /// most the 6 arguments jit_engine::call passes and returning a single
+  /// result. Defined next to ast_function.
+  bool can_call(const vsx_string<> &name, size_t args);
+
+  /// back_edge - step() for loop iterations, also counted towards promoting
+  /// the current function. Defined next to ast_function.
+  bool back_edge();
+
+  static evaluator* get_instance()
+  {
+    return compilation_context::current()->get<evaluator>(compilation_context::c_evaluator);
+  }
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef FUNCTION_REGISTRY_H
+#define FUNCTION_REGISTRY_H
+
+#include "vsx_string.h"
+#include "compilation_context.h"
+
+class ast_function_prototype;
+class ast_function;
+
+/// function_registry - The most recent prototype and definition for each
+/// function name, so code generation can find result names and signatures by
+/// name and the evaluator can find bodies. Functions can be redefined, the
+/// number of definitions so far gives each one its own symbol.
+class function_registry
+{
+  std::map<vsx_string<>, ast_function_prototype* > prototypes;
+  std::map<vsx_string<>, ast_function* > functions;
+  std::map<vsx_string<>, unsigned> definitions;
+
+public:
+
+  void set_prototype(vsx_string<> name, ast_function_prototype* p)
+  {
+    prototypes[name] = p;
+  }
+
+  void erase_prototype(vsx_string<> name)
+  {
+    prototypes.erase(name);
+  }
+
+  ast_function_prototype* get_prototype(vsx_string<> name)
+  {
+    if (prototypes.find(name) == prototypes.end())
+      return 0;
+    return prototypes[name];
+  }
+
+  void set_function(vsx_string<> name, ast_function* f)
+  {
+    functions[name] = f;
+    definitions[name]++;
+  }
+
+  /// get_definition_count - How many times name has been defined.
+  unsigned get_definition_count(vsx_string<> name)
+  {
+    if (definitions.find(name) == definitions.end())
+      return 0;
+    return definitions[name];
+  }
+
+  ast_function* get_function(vsx_string<> name)
+  {
+    if (functions.find(name) == functions.end())
+      return 0;
+    return functions[name];
+  }
+
+  static function_registry* get_instance()
+  {
+    return compilation_context::current()->get<function_registry>(compilation_context::c_functions);
+  }
+};
+
+#endif
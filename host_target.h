@@ -0,0 +1,84 @@
+#ifndef HOST_TARGET_H
+#define HOST_TARGET_H
+
+#include <string>
+#include <vector>
+
+#include "llvm_includes.h"
+#include "options.h"
+
+/// host_target - The CPU, features and code generation options the JIT and
+/// the AOT compiler generate code for.
+///
+/// By default that is the machine toy runs on: its CPU name and the features
+/// it reports, so AVX2 and FMA get used where they are there. -mcpu and
+/// -mattr override both, e.g. -mcpu=x86-64 for an object that runs on any
+/// x86-64. An -mcpu without -mattr takes the features of that CPU only.
+class host_target
+{
+public:
+
+  static std::string get_cpu()
+  {
+    if (const char *cpu = options::get_instance()->get_mcpu())
+      return cpu;
+    return llvm::sys::getHostCPUName();
+  }
+
+  /// get_features - Feature list in -mattr form ("+avx2", "-fma4", ...).
+  static std::vector<std::string> get_features()
+  {
+    std::vector<std::string> Features;
+    if (const char *mattr = options::get_instance()->get_mattr())
+    {
+      llvm::SmallVector<llvm::StringRef, 16> Attrs;
+      llvm::StringRef(mattr).split(Attrs, ",");
+      for (unsigned i = 0; i != Attrs.size(); i++)
+        if (!Attrs[i].empty())
+          Features.push_back(Attrs[i]);
+      return Features;
+    }
+    if (options::get_instance()->get_mcpu())
+      return Features;
+
+    // Hosts that cannot report their features rely on the CPU name alone.
+    llvm::StringMap<bool> HostFeatures;
+    if (llvm::sys::getHostCPUFeatures(HostFeatures))
+      for (llvm::StringMap<bool>::iterator I = HostFeatures.begin(), E = HostFeatures.end(); I != E; ++I)
+        Features.push_back((I->second ? "+" : "-") + I->first().str());
+    return Features;
+  }
+
+  static std::string get_feature_string()
+  {
+    std::vector<std::string> Features = get_features();
+    std::string S;
+    for (size_t i = 0; i < Features.size(); i++)
+      S += (i ? "," : "") + Features[i];
+    return S;
+  }
+
+  /// get_target_options - -ffp-contract=fast lets the backend fuse a
+  /// floating point multiply and add into an FMA where the CPU has one. That
+  /// rounds once instead of twice, so results can change in the last bit.
+  static llvm::TargetOptions get_target_options()
+  {
+    llvm::TargetOptions Options;
+    if (options::get_instance()->get_fp_contract())
+      Options.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+    return Options;
+  }
+
+  static llvm::CodeGenOpt::Level get_codegen_level(unsigned level)
+  {
+    switch (level)
+    {
+      case 0: return llvm::CodeGenOpt::None;
+      case 1: return llvm::CodeGenOpt::Less;
+      case 2: return llvm::CodeGenOpt::Default;
+    }
+    return llvm::CodeGenOpt::Aggressive;
+  }
+};
+
+#endif
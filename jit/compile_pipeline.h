@@ -0,0 +1,256 @@
+#ifndef COMPILE_PIPELINE_H
+#define COMPILE_PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvm_includes.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "optimizer.h"
+#include "options.h"
+#include "remarks.h"
+#include "trace.h"
+#include "jit/object_cache.h"
+
+/// compile_job - One definition on its way through the pipeline: bitcode in,
+/// object file out.
+struct compile_job
+{
+  std::string name;               // function name
+  std::string symbol;             // symbol of this definition
+  std::string bitcode;            // unoptimized module, freed once parsed
+  std::vector<std::string> calls; // functions it calls directly
+
+  std::unique_ptr<llvm::MemoryBuffer> object; // 0 if compilation failed
+
+  bool done = false;
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  void finish(std::unique_ptr<llvm::MemoryBuffer> Object)
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    object = std::move(Object);
+    done = true;
+    cv.notify_all();
+  }
+
+  bool is_done()
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    return done;
+  }
+
+  void wait()
+  {
+    std::unique_lock<std::mutex> Lock(mutex);
+    cv.wait(Lock, [this] { return done; });
+  }
+};
+
+/// compile_pipeline - Background optimization and machine code emission.
+///
+/// The main thread parses and generates IR, then hands each definition over
+/// as bitcode and moves on to the next one. A pool of workers, each with its
+/// own LLVMContext and TargetMachine, parses the bitcode, runs the function
+/// passes and emits an object file, so definitions are compiled in parallel
+/// with each other and with parsing. Finished objects are passed to the
+/// done callback, the JIT links them in (see jit_engine::on_compiled). The
+/// callback must not block on anything held while waiting for a job.
+class compile_pipeline
+{
+  std::vector<std::thread> workers;
+  std::vector<llvm::TargetMachine *> target_machines;
+
+  std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  std::deque< std::shared_ptr<compile_job> > queue;
+  bool stopping = false;
+
+  std::function<void(const std::shared_ptr<compile_job> &)> on_done;
+
+  std::atomic<uint64_t> compiled;
+  unsigned threads = 0;
+
+  /// compile - Optimize the job's module and emit it as an object file, the
+  /// same way MCJIT does, including the object cache.
+  std::unique_ptr<llvm::MemoryBuffer> compile(compile_job &job, llvm::LLVMContext &Context,
+                                              llvm::TargetMachine *TM)
+  {
+    trace::get_instance()->set_item(job.symbol);
+    trace_scope Deserialize("deserialize");
+    llvm::ErrorOr<llvm::Module *> Parsed =
+        llvm::parseBitcodeFile(llvm::MemoryBufferRef(job.bitcode, job.symbol), Context);
+    if (!Parsed)
+    {
+      fprintf(stderr, "JIT: could not read %s: %s\n", job.symbol.c_str(),
+              Parsed.getError().message().c_str());
+      return nullptr;
+    }
+    std::unique_ptr<llvm::Module> M(*Parsed);
+    std::string().swap(job.bitcode);
+    Deserialize.end();
+
+    trace_scope Optimize("optimize");
+    llvm::legacy::FunctionPassManager FPM(M.get());
+    optimizer::add_function_passes(FPM, TM, options::get_instance()->get_opt_level());
+    FPM.doInitialization();
+    bool Remarks = remarks::get_instance()->is_enabled();
+    for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+      if (!F->isDeclaration())
+      {
+        if (Remarks)
+          remarks::get_instance()->begin_function(*F);
+        FPM.run(*F);
+        if (Remarks)
+          remarks::get_instance()->end_function(*F);
+      }
+    FPM.doFinalization();
+    Optimize.end();
+
+    trace_scope Emit("emit");
+    bool cached = options::get_instance()->get_cache_dir() != 0;
+    if (cached)
+      if (std::unique_ptr<llvm::MemoryBuffer> Object = object_cache::get_instance()->getObject(M.get()))
+        return Object;
+
+    llvm::SmallVector<char, 4096> Buffer;
+    {
+      llvm::raw_svector_ostream OS(Buffer);
+      llvm::legacy::PassManager PM;
+      PM.add(new llvm::DataLayoutPass());
+      llvm::MCContext *Ctx;
+      if (TM->addPassesToEmitMC(PM, Ctx, OS))
+      {
+        fprintf(stderr, "JIT: target does not support MC emission\n");
+        return nullptr;
+      }
+      PM.run(*M);
+      OS.flush();
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> Object =
+        llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(Buffer.data(), Buffer.size()), job.symbol);
+    if (cached)
+      object_cache::get_instance()->notifyObjectCompiled(M.get(), Object->getMemBufferRef());
+    return Object;
+  }
+
+  void run_worker(llvm::TargetMachine *TM)
+  {
+    llvm::LLVMContext Context;
+    remarks::get_instance()->install(Context);
+    for (;;)
+    {
+      std::shared_ptr<compile_job> job;
+      {
+        std::unique_lock<std::mutex> Lock(queue_mutex);
+        queue_cv.wait(Lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty())
+          return;
+        job = queue.front();
+        queue.pop_front();
+      }
+
+      job->finish(compile(*job, Context, TM));
+      compiled++;
+      on_done(job);
+    }
+  }
+
+public:
+
+  compile_pipeline()
+    : compiled(0)
+  {
+  }
+
+  /// start - Start count workers, compiling for the same target as TM.
+  void start(unsigned count, llvm::TargetMachine *TM,
+             std::function<void(const std::shared_ptr<compile_job> &)> done)
+  {
+    on_done = done;
+    threads = count;
+    for (unsigned i = 0; i < count; i++)
+    {
+      llvm::TargetMachine *WorkerTM = TM->getTarget().createTargetMachine(
+            TM->getTargetTriple(), TM->getTargetCPU(), TM->getTargetFeatureString(),
+            TM->Options, TM->getRelocationModel(), TM->getCodeModel(), TM->getOptLevel());
+      target_machines.push_back(WorkerTM);
+      workers.push_back(std::thread(&compile_pipeline::run_worker, this, WorkerTM));
+    }
+  }
+
+  bool is_running()
+  {
+    return !workers.empty();
+  }
+
+  /// make_job - Serialize M, which defines symbol, for the workers. M is not
+  /// needed afterwards.
+  static std::shared_ptr<compile_job> make_job(llvm::Module *M, const std::string &name,
+                                               const std::string &symbol)
+  {
+    std::shared_ptr<compile_job> job = std::make_shared<compile_job>();
+    job->name = name;
+    job->symbol = symbol;
+
+    llvm::raw_string_ostream OS(job->bitcode);
+    llvm::WriteBitcodeToFile(M, OS);
+    OS.flush();
+
+    for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+      if (F->isDeclaration() && !F->isIntrinsic())
+        job->calls.push_back(F->getName());
+    return job;
+  }
+
+  void enqueue(const std::shared_ptr<compile_job> &job)
+  {
+    std::lock_guard<std::mutex> Lock(queue_mutex);
+    queue.push_back(job);
+    queue_cv.notify_one();
+  }
+
+  /// shutdown - Let the workers finish the queue and stop them.
+  void shutdown()
+  {
+    {
+      std::lock_guard<std::mutex> Lock(queue_mutex);
+      stopping = true;
+      queue_cv.notify_all();
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+    workers.clear();
+
+    for (size_t i = 0; i < target_machines.size(); i++)
+      delete target_machines[i];
+    target_machines.clear();
+  }
+
+  void print_stats()
+  {
+    fprintf(stderr, "Pipeline: %llu definitions compiled on %u threads\n",
+            (unsigned long long)compiled.load(), threads);
+  }
+
+  static compile_pipeline* get_instance()
+  {
+    static compile_pipeline cp;
+    return &cp;
+  }
+};
+
+#endif
@@ -0,0 +1,875 @@
+#ifndef JIT_ENGINE_H
+#define JIT_ENGINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm_includes.h"
+#include "llvm_helper.h"
+#include "module_manager.h"
+#include "builder_manager.h"
+#include "host_target.h"
+#include "optimizer.h"
+#include "options.h"
+#include "trace.h"
+#include "debuginfo/debuginfo_manager.h"
+#include "jit/jit_memory_manager.h"
+#include "jit/object_cache.h"
+#include "jit/compile_pipeline.h"
+#include "jit/perf_listener.h"
+#include "llvm/Object/ObjectFile.h"
+
+typedef std::atomic<uint64_t> jit_slot;
+
+extern "C" uint64_t kaleidoscope_jit_compile(jit_slot *slot);
+extern "C" double kaleidoscope_tier_call(jit_slot *slot, double *args);
+
+/// jit_engine - Lazy, per definition JIT on top of MCJIT.
+///
+/// Every definition is generated into a module of its own, which is only
+/// handed to MCJIT once it is needed. Calls to a definition from other
+/// modules go through its dispatch slot: the caller loads the slot and, while
+/// it is still empty, calls back into the host. With tiering the host
+/// interprets the callee until it is hot (see tiering), otherwise it compiles
+/// the callee and fills the slot.
+///
+/// Once the machine code of a module is emitted the module is dropped, so
+/// memory grows with native code size rather than IR size.
+///
+/// The slots double as a GOT for redefinitions: a function can be redefined
+/// while the program runs, the new definition is swapped into the slot and
+/// the old code is freed once it is unreachable (see add_definition).
+///
+/// With background jobs (-jobs=N) definitions do not wait for their first
+/// call: they go through the compile pipeline right away and are linked in
+/// as soon as their object is ready, while the main thread keeps parsing.
+/// A top-level expression waits only for the definitions it calls.
+///
+/// Several compilation contexts can use the JIT at once. Functions are keyed
+/// by their context's symbol prefix ("ctx1.fib"), see qualify, so each
+/// context has its own slots and definitions.
+///
+/// Locking: a thread generating code holds only its context's mutex (see
+/// compilation_context), so contexts generate code in parallel. The JIT's
+/// own state and MCJIT are guarded by llvm_mutex, taken briefly for slot
+/// lookups and for compiling and linking. Compiling the IR of a context
+/// takes the context's mutex first, so the tiering worker never compiles a
+/// module of a context while its thread generates code; nothing holding
+/// llvm_mutex waits for a context's mutex. The llvm_mutex holder may wait
+/// for pipeline jobs, so the pipeline workers never block on it: a finished
+/// job is linked right away if the lock is free and otherwise left on a
+/// ready list for the holder (see on_compiled).
+class jit_engine
+{
+public:
+
+  /// slot_info - The function behind a dispatch slot.
+  struct slot_info
+  {
+    std::string key;  // qualified name
+    std::string name; // name in its context
+    compilation_context *context;
+  };
+
+private:
+
+  llvm::ExecutionEngine *engine = 0;
+  jit_memory_manager *memory_manager = 0;
+
+  // Maps by name are keyed by qualified name, symbols are unique already.
+
+  // Definitions that have been generated but not handed to MCJIT yet, by
+  // symbol.
+  std::map<std::string, llvm::Module *> pending;
+
+  // Definitions in the compile pipeline, or compiled but not linked in yet,
+  // by symbol.
+  std::map<std::string, std::shared_ptr<compile_job> > jobs;
+
+  // Symbol of the current definition of each function; redefinitions are
+  // named name.N.
+  std::map<std::string, std::string> targets;
+
+  // Memory owner of each compiled symbol.
+  std::map<std::string, uint64_t> owner_of;
+
+  // Symbols called directly (externs defined later), whose code can never
+  // be freed.
+  std::set<std::string> pinned;
+
+  // Owners of replaced definitions, released at the next quiescent point
+  // of their context.
+  std::map<compilation_context *, std::vector<uint64_t> > retired;
+
+  // One slot per lazily compiled function, holding its address once it is
+  // compiled. A deque, so slot addresses stay stable as it grows.
+  std::deque<jit_slot> slots;
+  std::map<std::string, jit_slot *> slot_by_name;
+  std::map<const jit_slot *, slot_info> info_by_slot;
+
+  std::recursive_mutex llvm_mutex;
+
+  // Jobs finished while llvm_mutex was taken, by symbol.
+  std::mutex ready_mutex;
+  std::vector<std::string> ready;
+
+  // Modules handed to MCJIT whose code has not been emitted yet.
+  std::vector<llvm::Module *> submitted;
+
+  // Memory owner of each top-level expression, released once it has run.
+  std::map<std::string, uint64_t> entry_owners;
+
+  uint64_t modules_emitted = 0;
+
+  static std::string slot_symbol(const std::string &name)
+  {
+    return "__kaleidoscope_slot." + name;
+  }
+
+  /// get_slot - The slot of function name of the current context, keyed
+  /// key.
+  jit_slot *get_slot(const std::string &key, const std::string &name)
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    std::map<std::string, jit_slot *>::iterator it = slot_by_name.find(key);
+    if (it != slot_by_name.end())
+      return it->second;
+
+    slots.emplace_back(0);
+    jit_slot *slot = &slots.back();
+    slot_by_name[key] = slot;
+    slot_info info = { key, name, compilation_context::current() };
+    info_by_slot[slot] = info;
+    memory_manager->add_symbol(slot_symbol(key), slot);
+    return slot;
+  }
+
+  jit_slot *find_slot_by_key(const std::string &key)
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    std::map<std::string, jit_slot *>::iterator it = slot_by_name.find(key);
+    return it == slot_by_name.end() ? 0 : it->second;
+  }
+
+  /// pin_declarations - Keep the code of everything M calls directly.
+  void pin_declarations(llvm::Module *M)
+  {
+    for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+      if (F->isDeclaration())
+        pinned.insert(F->getName());
+  }
+
+  /// submit - Hand a module to MCJIT, together with the pending modules it
+  /// calls directly (externs defined later, recursion), so MCJIT can link
+  /// them itself.
+  void submit(llvm::Module *M)
+  {
+    for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+      if (F->isDeclaration() && jobs.count(F->getName()))
+        load(F->getName(), true);
+
+    for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+      if (!F->isDeclaration())
+        pending.erase(F->getName());
+
+    engine->addModule(std::unique_ptr<llvm::Module>(M));
+    submitted.push_back(M);
+
+    for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+      if (F->isDeclaration())
+        submit(F->getName());
+  }
+
+  void submit(const std::string &name)
+  {
+    std::map<std::string, llvm::Module *>::iterator it = pending.find(name);
+    if (it != pending.end())
+      submit(it->second);
+  }
+
+  /// link_ready - Link the jobs left by on_compiled. llvm_mutex is held.
+  void link_ready()
+  {
+    std::vector<std::string> symbols;
+    {
+      std::lock_guard<std::mutex> Lock(ready_mutex);
+      symbols.swap(ready);
+    }
+    for (size_t i = 0; i < symbols.size(); i++)
+      load(symbols[i], false);
+  }
+
+  /// on_compiled - Called by a pipeline worker when symbol is compiled. The
+  /// worker must not block on llvm_mutex, whose holder may be waiting for a
+  /// job queued behind this one; if the lock is taken the job is left to
+  /// the holder, linked at the next collect or when something needs it.
+  void on_compiled(const std::string &symbol)
+  {
+    if (llvm_mutex.try_lock())
+    {
+      load(symbol, false);
+      link_ready();
+      llvm_mutex.unlock();
+      return;
+    }
+
+    std::lock_guard<std::mutex> Lock(ready_mutex);
+    ready.push_back(symbol);
+  }
+
+  /// finalize - Apply relocations and permissions to everything loaded, then
+  /// tell perf about the new code.
+  void finalize()
+  {
+    engine->finalizeObject();
+    if (perf_listener::get_instance()->is_enabled())
+      perf_listener::get_instance()->flush();
+  }
+
+  /// emit_submitted - Emit and finalize the machine code of every submitted
+  /// module, then drop the modules. The code stays loaded and linkable by
+  /// symbol name, so the IR is not needed anymore. Returns the memory owner
+  /// of the first module.
+  uint64_t emit_submitted()
+  {
+    trace_scope Emit("emit");
+    uint64_t first_owner = 0;
+    for (size_t i = 0; i < submitted.size(); i++)
+    {
+      uint64_t owner = memory_manager->begin_owner();
+      if (!i)
+        first_owner = owner;
+      engine->generateCodeForModule(submitted[i]);
+
+      llvm::Module *M = submitted[i];
+      if (memory_stats::get_instance()->is_enabled())
+        memory_stats::get_instance()->add_code_bytes(M->getModuleIdentifier(),
+                                                      memory_manager->get_code_bytes(owner));
+      for (llvm::Module::iterator F = M->begin(), E = M->end(); F != E; ++F)
+        if (!F->isDeclaration())
+          owner_of[F->getName()] = owner;
+    }
+    finalize();
+
+    for (size_t i = 0; i < submitted.size(); i++)
+    {
+      engine->removeModule(submitted[i]);
+      delete submitted[i];
+    }
+    modules_emitted += submitted.size();
+    submitted.clear();
+    return first_owner;
+  }
+
+public:
+
+  /// init - Create the MCJIT engine. The engine needs a module up front, it
+  /// gets an empty one; all code lives in per definition modules.
+  bool init(std::string &ErrStr)
+  {
+    std::unique_ptr<llvm::Module> Owner =
+        llvm::make_unique<llvm::Module>("my cool jit", compilation_context::current()->get_llvm_context());
+    std::unique_ptr<jit_memory_manager> MM =
+        llvm::make_unique<jit_memory_manager>(options::get_instance()->get_huge_pages());
+    memory_manager = MM.get();
+
+    engine =
+        llvm::EngineBuilder(std::move(Owner))
+            .setErrorStr(&ErrStr)
+            .setMCJITMemoryManager(std::move(MM))
+            .setMCPU(host_target::get_cpu())
+            .setMAttrs(host_target::get_features())
+            .setTargetOptions(host_target::get_target_options())
+            .setOptLevel(host_target::get_codegen_level(options::get_instance()->get_opt_level()))
+            .create();
+    if (!engine)
+      return false;
+
+    memory_manager->add_symbol("kaleidoscope_jit_compile", (void *)&kaleidoscope_jit_compile);
+    memory_manager->add_symbol("kaleidoscope_tier_call", (void *)&kaleidoscope_tier_call);
+
+    bool perf_map = options::get_instance()->get_perf_map();
+    bool jitdump = options::get_instance()->get_jitdump();
+    if (perf_map || jitdump)
+    {
+      if (!perf_listener::get_instance()->init(perf_map, jitdump))
+      {
+        ErrStr = "could not create the perf map or jitdump file";
+        return false;
+      }
+      engine->RegisterJITEventListener(perf_listener::get_instance());
+    }
+
+    if (const char *dir = options::get_instance()->get_cache_dir())
+    {
+      // Objects are only valid for the same code generation settings.
+      llvm::TargetMachine *TM = engine->getTargetMachine();
+      std::string target =
+          "O" + std::to_string((long long)options::get_instance()->get_opt_level()) + " " +
+          TM->getTargetTriple().str() + " " +
+          TM->getTargetCPU().str() + " " +
+          TM->getTargetFeatureString().str() +
+          (TM->Options.AllowFPOpFusion == llvm::FPOpFusion::Fast ? " fp-contract" : "");
+
+      object_cache::get_instance()->init(dir, options::get_instance()->get_cache_size_bytes(), target);
+      engine->setObjectCache(object_cache::get_instance());
+    }
+
+    // Link objects in as soon as they are compiled.
+    if (unsigned threads = options::get_instance()->get_jobs())
+      compile_pipeline::get_instance()->start(threads, engine->getTargetMachine(),
+        [this](const std::shared_ptr<compile_job> &job) { on_compiled(job->symbol); });
+    return true;
+  }
+
+  /// add_host_symbol - Make a host function callable from generated code.
+  void add_host_symbol(const std::string &name, void *address)
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    memory_manager->add_symbol(name, address);
+  }
+
+  /// get_host_symbol - Address of a host function, or 0. Externs that are
+  /// not registered resolve like in generated code, e.g. sin from libm.
+  uint64_t get_host_symbol(const std::string &name)
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    return memory_manager->getSymbolAddress(name);
+  }
+
+  /// qualify - The JIT wide name of function name of the current context.
+  static std::string qualify(const std::string &name)
+  {
+    return compilation_context::current()->get_symbol_prefix() + name;
+  }
+
+  /// begin_module - Start a fresh module for one definition, with its own
+  /// debug info compile unit and function pass pipeline. Definitions that go
+  /// through the compile pipeline are optimized there instead. The current
+  /// context's mutex is held until end_module, llvm_mutex is not.
+  void begin_module(const std::string &name, bool optimize = true)
+  {
+    compilation_context::current()->get_mutex().lock();
+
+    llvm::Module *M = new llvm::Module(name, compilation_context::current()->get_llvm_context());
+    M->setDataLayout(engine->getDataLayout());
+    module_manager::get_instance()->set(M);
+
+    if (options::get_instance()->get_debug_info())
+    {
+      // Add the current debug info version into the module.
+      M->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+
+      // Darwin only supports dwarf2.
+      if (llvm::Triple(llvm::sys::getProcessTriple()).isOSDarwin())
+        M->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 2);
+
+      builder_manager::get_instance()->set_di( new llvm::DIBuilder(*M) );
+    }
+    debug_manager::get_instance()->init();
+
+    if (!optimize)
+      return;
+
+    llvm::legacy::FunctionPassManager *FPM = new llvm::legacy::FunctionPassManager(M);
+    optimizer::add_function_passes(*FPM, engine->getTargetMachine(), options::get_instance()->get_opt_level());
+    FPM->doInitialization();
+    module_manager::get_instance()->set_fpm(FPM);
+  }
+
+  /// end_module - Finish the current module and return it.
+  llvm::Module *end_module()
+  {
+    llvm::Module *M = module_manager::get_instance()->get();
+
+    if (llvm::legacy::FunctionPassManager *FPM = module_manager::get_instance()->get_fpm())
+    {
+      FPM->doFinalization();
+      delete FPM;
+      module_manager::get_instance()->set_fpm(0);
+    }
+
+    if (llvm::DIBuilder *DI = builder_manager::get_instance()->get_di())
+    {
+      DI->finalize();
+      delete DI;
+      builder_manager::get_instance()->set_di(0);
+    }
+
+    module_manager::get_instance()->set(0);
+
+    if (options::get_instance()->get_dump_ir())
+      M->dump();
+
+    compilation_context::current()->get_mutex().unlock();
+    return M;
+  }
+
+  /// load - Make symbol callable, together with the definitions it calls
+  /// directly: emit it if it is still IR, or link in its object once the
+  /// pipeline has compiled it. Without wait gives up instead of blocking
+  /// when something is not compiled yet or cannot be resolved.
+  bool load(const std::string &symbol, bool wait)
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+
+    // Called from submit, whose caller finishes the emission.
+    bool nested = !submitted.empty();
+
+    std::vector< std::shared_ptr<compile_job> > group;
+    std::set<std::string> seen;
+    std::vector<std::string> work(1, symbol);
+    while (!work.empty())
+    {
+      std::string s = work.back();
+      work.pop_back();
+      if (!seen.insert(s).second)
+        continue;
+
+      if (pending.count(s))
+      {
+        if (!wait)
+          return false;
+        submit(s);
+        continue;
+      }
+
+      std::map<std::string, std::shared_ptr<compile_job> >::iterator it = jobs.find(s);
+      if (it == jobs.end())
+      {
+        // Linked already, or a host function. Linking against a definition
+        // that does not exist yet would be fatal.
+        if (!wait && s != symbol && !owner_of.count(s) && !memory_manager->getSymbolAddress(s))
+          return false;
+        continue;
+      }
+
+      if (!wait && !it->second->is_done())
+        return false;
+      group.push_back(it->second);
+      work.insert(work.end(), it->second->calls.begin(), it->second->calls.end());
+    }
+
+    trace_scope Link("link");
+    for (size_t i = 0; i < group.size(); i++)
+    {
+      compile_job &job = *group[i];
+      // Safe with llvm_mutex held, workers never block on it.
+      job.wait();
+      jobs.erase(job.symbol);
+
+      if (!job.object)
+      {
+        fprintf(stderr, "JIT: could not compile %s\n", job.symbol.c_str());
+        abort();
+      }
+
+      llvm::ErrorOr< std::unique_ptr<llvm::object::ObjectFile> > Object =
+          llvm::object::ObjectFile::createObjectFile(job.object->getMemBufferRef());
+      if (!Object)
+      {
+        fprintf(stderr, "JIT: could not load %s: %s\n", job.symbol.c_str(),
+                Object.getError().message().c_str());
+        abort();
+      }
+
+      uint64_t owner = memory_manager->begin_owner();
+      owner_of[job.symbol] = owner;
+      engine->addObjectFile(llvm::object::OwningBinary<llvm::object::ObjectFile>(
+                              std::move(*Object), std::move(job.object)));
+      modules_emitted++;
+
+      if (memory_stats::get_instance()->is_enabled())
+        memory_stats::get_instance()->add_code_bytes(job.name, memory_manager->get_code_bytes(owner));
+    }
+
+    if (nested)
+      return true;
+    if (!submitted.empty())
+      emit_submitted();
+    else if (!group.empty())
+      finalize();
+
+    // Publish the definitions that are still current.
+    for (size_t i = 0; i < group.size(); i++)
+    {
+      std::map<std::string, std::string>::iterator t = targets.find(group[i]->name);
+      if (t != targets.end() && t->second == group[i]->symbol)
+        slot_by_name[t->first]->store(engine->getFunctionAddress(t->second), std::memory_order_release);
+    }
+    return true;
+  }
+
+  /// emit_function - Compile symbol and everything it links against.
+  uint64_t emit_function(const std::string &symbol)
+  {
+    load(symbol, true);
+    uint64_t Address = engine->getFunctionAddress(symbol);
+    if (Address == 0)
+    {
+      fprintf(stderr, "JIT: could not compile %s\n", symbol.c_str());
+      abort();
+    }
+    return Address;
+  }
+
+  /// add_definition - Register M, defining function name of the current
+  /// context as symbol, for lazy compilation. Nothing is compiled until the
+  /// first call.
+  ///
+  /// A redefinition replaces the target of the dispatch slot. If the old
+  /// definition was already compiled the new one is compiled right away and
+  /// swapped in with one atomic store, so calls already in flight finish in
+  /// the old code and every later call runs the new one. The old code is
+  /// retired and freed at the next quiescent point, see collect.
+  void add_definition(llvm::Module *M, const std::string &name, const std::string &symbol)
+  {
+    std::lock_guard<std::recursive_mutex> ContextLock(compilation_context::current()->get_mutex());
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    pin_declarations(M);
+    std::string key = qualify(name);
+    jit_slot *slot = get_slot(key, name);
+
+    if (compile_pipeline::get_instance()->is_running())
+    {
+      trace_scope Serialize("serialize");
+      std::shared_ptr<compile_job> job = compile_pipeline::make_job(M, key, symbol);
+      delete M;
+      jobs[symbol] = job;
+      compile_pipeline::get_instance()->enqueue(job);
+    }
+    else
+      pending[symbol] = M;
+
+    std::map<std::string, std::string>::iterator it = targets.find(key);
+    if (it == targets.end())
+    {
+      targets[key] = symbol;
+      return;
+    }
+
+    std::string old_symbol = it->second;
+    it->second = symbol;
+
+    if (slot->load(std::memory_order_acquire))
+    {
+      std::chrono::high_resolution_clock::time_point Start = std::chrono::high_resolution_clock::now();
+      slot->store(emit_function(symbol), std::memory_order_release);
+      fprintf(stderr, "Swapped in new %s in %.3f ms\n", key.c_str(),
+              std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - Start).count());
+    }
+
+    if (pinned.count(old_symbol))
+      return;
+
+    std::map<std::string, llvm::Module *>::iterator p = pending.find(old_symbol);
+    if (p != pending.end())
+    {
+      // Never compiled, just drop the IR.
+      delete p->second;
+      pending.erase(p);
+      return;
+    }
+
+    // Still in the pipeline, the object is dropped when it comes out.
+    if (jobs.erase(old_symbol))
+      return;
+
+    std::map<std::string, uint64_t>::iterator o = owner_of.find(old_symbol);
+    if (o != owner_of.end())
+    {
+      retired[compilation_context::current()].push_back(o->second);
+      owner_of.erase(o);
+    }
+  }
+
+  /// collect - Free the code of definitions the current context replaced.
+  /// Only called between top-level items, when no generated code of the
+  /// context is running, so nothing can still be executing it; calls reach
+  /// it only through the slots, which no longer point to it. Other contexts
+  /// never call it.
+  void collect()
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    link_ready();
+    std::vector<uint64_t> &owners = retired[compilation_context::current()];
+    for (size_t i = 0; i < owners.size(); i++)
+      memory_manager->release(owners[i]);
+    owners.clear();
+  }
+
+  /// is_lazy - Whether calls to name go through a dispatch slot.
+  bool is_lazy(const std::string &name)
+  {
+    return find_slot_by_key(qualify(name)) != 0;
+  }
+
+  /// find_slot - The dispatch slot of name, or 0.
+  jit_slot *find_slot(const std::string &name)
+  {
+    return find_slot_by_key(qualify(name));
+  }
+
+  /// emit_slot_call - Emit a call through the dispatch slot of name:
+  ///
+  ///   target = load atomic slot
+  ///   br (target == 0), cold, call
+  /// cold:
+  ///   interpreted = kaleidoscope_tier_call(slot, args)      ; tiering
+  ///   compiled = kaleidoscope_jit_compile(slot)             ; otherwise
+  /// call:
+  ///   result = call target(args)
+  llvm::Value *emit_slot_call
+  (
+    const std::string &name,
+    llvm::FunctionType *FT,
+    llvm::ArrayRef<llvm::Value *> Args,
+    const char *TmpName
+  )
+  {
+    llvm::LLVMContext &Context = compilation_context::current()->get_llvm_context();
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    llvm::Module *M = module_manager::get_instance()->get();
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::Type *Int64Ty = llvm::Type::getInt64Ty(Context);
+    llvm::Type *DoubleTy = llvm::Type::getDoubleTy(Context);
+
+    std::string key = qualify(name);
+    get_slot(key, name);
+    llvm::Constant *Slot = M->getOrInsertGlobal(slot_symbol(key), Int64Ty);
+
+    llvm::LoadInst *Target = Builder->CreateLoad(Slot, (name + ".target").c_str());
+    Target->setAlignment(8);
+    Target->setAtomic(llvm::Acquire);
+
+    llvm::BasicBlock *EntryBB = Builder->GetInsertBlock();
+    llvm::BasicBlock *ColdBB = llvm::BasicBlock::Create(Context, "cold", TheFunction);
+    llvm::BasicBlock *CallBB = llvm::BasicBlock::Create(Context, "call", TheFunction);
+
+    // The slot is empty only until the callee is compiled.
+    llvm::Value *IsEmpty = Builder->CreateICmpEQ(Target, llvm::ConstantInt::get(Int64Ty, 0), "empty");
+    Builder->CreateCondBr(IsEmpty, ColdBB, CallBB,
+                          llvm::MDBuilder(Context).createBranchWeights(1, 1 << 20));
+
+    Builder->SetInsertPoint(ColdBB);
+
+    // Only plain double functions the host can call back can be
+    // interpreted, others are compiled on the first call.
+    if (options::get_instance()->get_tiering() && FT->getReturnType() == DoubleTy &&
+        Args.size() <= max_call_args)
+    {
+      llvm::Value *ArgsPtr = llvm::Constant::getNullValue(DoubleTy->getPointerTo());
+      if (Args.size())
+      {
+        llvm::AllocaInst *Array =
+            llvm_helper::CreateEntryBlockArrayAlloca(TheFunction, name + ".args", Args.size());
+        for (unsigned i = 0, e = Args.size(); i != e; ++i)
+          Builder->CreateStore(Args[i], Builder->CreateConstInBoundsGEP2_64(Array, 0, i));
+        ArgsPtr = Builder->CreateConstInBoundsGEP2_64(Array, 0, 0);
+      }
+
+      llvm::Constant *TierCall =
+          M->getOrInsertFunction("kaleidoscope_tier_call", DoubleTy, Int64Ty->getPointerTo(),
+                                 DoubleTy->getPointerTo(), nullptr);
+      llvm::Value *Interpreted = Builder->CreateCall2(TierCall, Slot, ArgsPtr, "interpreted");
+      llvm::BasicBlock *InterpretedBB = Builder->GetInsertBlock();
+
+      llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(Context, "merge", TheFunction);
+      Builder->CreateBr(MergeBB);
+
+      Builder->SetInsertPoint(CallBB);
+      llvm::Value *Callee = Builder->CreateIntToPtr(Target, FT->getPointerTo(), "callee");
+      llvm::Value *Native = Builder->CreateCall(Callee, Args, TmpName);
+      Builder->CreateBr(MergeBB);
+
+      Builder->SetInsertPoint(MergeBB);
+      llvm::PHINode *PN = Builder->CreatePHI(DoubleTy, 2, TmpName);
+      PN->addIncoming(Interpreted, InterpretedBB);
+      PN->addIncoming(Native, CallBB);
+      return PN;
+    }
+
+    llvm::Constant *Compile =
+        M->getOrInsertFunction("kaleidoscope_jit_compile", Int64Ty, Int64Ty->getPointerTo(), nullptr);
+    llvm::Value *Compiled = Builder->CreateCall(Compile, Slot, "compiled");
+    Builder->CreateBr(CallBB);
+
+    Builder->SetInsertPoint(CallBB);
+    llvm::PHINode *Address = Builder->CreatePHI(Int64Ty, 2, "address");
+    Address->addIncoming(Target, EntryBB);
+    Address->addIncoming(Compiled, ColdBB);
+
+    llvm::Value *Callee = Builder->CreateIntToPtr(Address, FT->getPointerTo(), "callee");
+    return Builder->CreateCall(Callee, Args, TmpName);
+  }
+
+  /// get_slot_info - The function behind a dispatch slot.
+  const slot_info &get_slot_info(const jit_slot *slot)
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    std::map<const jit_slot *, slot_info>::iterator it = info_by_slot.find(slot);
+    if (it == info_by_slot.end())
+    {
+      fprintf(stderr, "JIT: call through an unknown dispatch slot\n");
+      abort();
+    }
+    return it->second;
+  }
+
+  /// get_compiled - Address of the compiled code of name, or 0 while it has
+  /// not been compiled.
+  uint64_t get_compiled(const std::string &name)
+  {
+    jit_slot *slot = find_slot(name);
+    return slot ? slot->load(std::memory_order_acquire) : 0;
+  }
+
+  /// compile_slot - Compile the function behind slot and publish it there.
+  /// Callable from any thread, the IR is compiled under its context's
+  /// mutex.
+  uint64_t compile_slot(jit_slot *slot)
+  {
+    uint64_t Address = slot->load(std::memory_order_acquire);
+    if (Address)
+      return Address;
+
+    const slot_info &info = get_slot_info(slot);
+    std::lock_guard<std::recursive_mutex> ContextLock(info.context->get_mutex());
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+
+    Address = slot->load(std::memory_order_acquire);
+    if (Address)
+      return Address;
+
+    Address = emit_function(targets[info.key]);
+    slot->store(Address, std::memory_order_release);
+    return Address;
+  }
+
+  /// compile_function - Compile name and publish it in its dispatch slot.
+  uint64_t compile_function(const std::string &name)
+  {
+    return compile_slot(get_slot(qualify(name), name));
+  }
+
+  /// compile - Compile the function behind a dispatch slot and fill the
+  /// slot. Called from generated code on the first call.
+  uint64_t compile(jit_slot *slot)
+  {
+    uint64_t Address = slot->load(std::memory_order_acquire);
+    if (Address)
+      return Address;
+
+    const std::string &name = get_slot_info(slot).key;
+    std::chrono::high_resolution_clock::time_point Start = std::chrono::high_resolution_clock::now();
+
+    Address = compile_slot(slot);
+
+    fprintf(stderr, "Compiled %s on first call in %.3f ms\n", name.c_str(),
+            std::chrono::duration<double, std::milli>(
+              std::chrono::high_resolution_clock::now() - Start).count());
+    return Address;
+  }
+
+  /// max_call_args - The most arguments call passes.
+  static const size_t max_call_args = 6;
+
+  /// call - Call compiled code taking and returning doubles from the host.
+  /// False if there are more than max_call_args arguments.
+  static bool call(uint64_t Address, const std::vector<double> &Args, double &Result)
+  {
+    const double *A = Args.data();
+    switch (Args.size())
+    {
+      case 0: Result = ((double (*)())Address)(); return true;
+      case 1: Result = ((double (*)(double))Address)(A[0]); return true;
+      case 2: Result = ((double (*)(double, double))Address)(A[0], A[1]); return true;
+      case 3: Result = ((double (*)(double, double, double))Address)(A[0], A[1], A[2]); return true;
+      case 4: Result = ((double (*)(double, double, double, double))Address)(A[0], A[1], A[2], A[3]); return true;
+      case 5: Result = ((double (*)(double, double, double, double, double))Address)(A[0], A[1], A[2], A[3], A[4]); return true;
+      case 6: Result = ((double (*)(double, double, double, double, double, double))Address)(A[0], A[1], A[2], A[3], A[4], A[5]); return true;
+    }
+    return false;
+  }
+
+  /// get_entry - Hand a top-level expression module of the current context
+  /// to MCJIT and return the address of its entry function symbol, or 0.
+  uint64_t get_entry(llvm::Module *M, const std::string &symbol)
+  {
+    std::lock_guard<std::recursive_mutex> ContextLock(compilation_context::current()->get_mutex());
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    pin_declarations(M);
+
+    // Barrier: wait for the definitions M calls through their slots, the
+    // rest are linked in by submit.
+    if (compile_pipeline::get_instance()->is_running())
+    {
+      std::string prefix = slot_symbol("");
+      for (llvm::Module::global_iterator G = M->global_begin(), E = M->global_end(); G != E; ++G)
+        if (G->getName().startswith(prefix))
+          compile_slot(slot_by_name[G->getName().substr(prefix.size())]);
+    }
+
+    // M is submitted before its dependencies, so it is the first module
+    // emitted.
+    submit(M);
+    entry_owners[symbol] = emit_submitted();
+    return engine->getFunctionAddress(symbol);
+  }
+
+  /// release_entry - Free the code of a top-level expression after it ran.
+  void release_entry(const std::string &symbol)
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    std::map<std::string, uint64_t>::iterator it = entry_owners.find(symbol);
+    if (it == entry_owners.end())
+      return;
+    memory_manager->release(it->second);
+    owner_of.erase(symbol);
+    entry_owners.erase(it);
+  }
+
+  jit_memory_manager *get_memory_manager()
+  {
+    return memory_manager;
+  }
+
+  /// get_modules_emitted - Number of modules compiled and dropped so far.
+  uint64_t get_modules_emitted()
+  {
+    return modules_emitted;
+  }
+
+  /// get_modules_pending - Number of definitions not linked in.
+  uint64_t get_modules_pending()
+  {
+    std::lock_guard<std::recursive_mutex> Lock(llvm_mutex);
+    std::set<llvm::Module *> modules;
+    for (std::map<std::string, llvm::Module *>::iterator it = pending.begin(); it != pending.end(); ++it)
+      modules.insert(it->second);
+    return modules.size() + jobs.size();
+  }
+
+  static jit_engine* get_instance()
+  {
+    static jit_engine je;
+    return &je;
+  }
+};
+
+/// kaleidoscope_jit_compile - Host callback behind every empty dispatch slot.
+extern "C" uint64_t kaleidoscope_jit_compile(jit_slot *slot)
+{
+  return jit_engine::get_instance()->compile(slot);
+}
+
+#endif
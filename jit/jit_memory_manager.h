@@ -0,0 +1,510 @@
+#ifndef JIT_MEMORY_MANAGER_H
+#define JIT_MEMORY_MANAGER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "llvm_includes.h"
+#include "llvm/Support/Memory.h"
+
+/// jit_memory_manager - Memory manager for MCJIT that carves sections out of
+/// large pooled mappings, and resolves the symbols the JIT provides itself
+/// (dispatch slots, host callbacks, library functions) before falling back to
+/// the symbols of the process.
+///
+/// Code, read only data and writable data each have their own pool, and
+/// allocations are packed densely one after the other, so the code of small
+/// modules shares pages. Allocations belong to an owner (one per module, see
+/// begin_owner). Released ranges go on a free list of their pool and are
+/// handed out again, whole pages inside them are returned to the system, and
+/// a chunk is unmapped once nothing in it is live.
+///
+/// Read only data and code are protected at finalizeMemory, which works on
+/// whole pages: after a finalize these pools continue on a fresh page, and
+/// only whole released pages can be reused, made writable again until the
+/// next finalize.
+///
+/// Each chunk counts the live bytes on every page. A page goes back to the
+/// system once nothing on it is live, also when the owners that shared it
+/// were smaller than a page, and in the protected pools it goes on the free
+/// list then.
+///
+/// With huge pages the code pool is backed by 2MB pages and mapped read,
+/// write and execute once, since protecting parts of it would split the huge
+/// pages again. Like writable data it is then packed across finalizes and
+/// reuses released ranges byte for byte.
+class jit_memory_manager : public llvm::RTDyldMemoryManager
+{
+public:
+
+  struct stats
+  {
+    uint64_t reserved = 0; // bytes mapped
+    uint64_t used = 0;     // bytes handed out to sections, live
+    uint64_t wasted = 0;   // alignment padding and page tails, live
+    uint64_t freed = 0;    // bytes released with their owner
+    uint64_t returned = 0; // bytes of pages given back to the system
+  };
+
+private:
+
+  static const uint64_t chunk_size = 64 << 20;
+  static const uint64_t huge_page_size = 2 << 20;
+
+  enum pool_kind
+  {
+    pool_code,
+    pool_rodata,
+    pool_data,
+    pool_count
+  };
+
+  struct chunk
+  {
+    uint8_t *base;
+    uint64_t size;
+    uint64_t cursor;
+    uint64_t protected_upto;
+    uint64_t live;
+    std::vector<uint32_t> page_live; // live bytes per page
+  };
+
+  struct range
+  {
+    pool_kind pool;
+    chunk *where;
+    uint64_t begin;
+    uint64_t end;
+    uint64_t used;
+  };
+
+  /// extent - Part of a chunk, free or waiting for finalizeMemory.
+  struct extent
+  {
+    chunk *where;
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  struct eh_frame
+  {
+    uint8_t *addr;
+    uint64_t load_addr;
+    size_t size;
+  };
+
+  struct pool
+  {
+    std::vector<chunk *> chunks;
+    std::vector<extent> free;    // released, sorted by chunk and address
+    std::vector<extent> pending; // reused since the last finalize
+  };
+
+  std::map<std::string, uint64_t> symbols;
+
+  pool pools[pool_count];
+  bool huge_pages = false;
+  uint64_t page_size;
+
+  uint64_t next_owner = 1;
+  uint64_t current_owner = 0;
+  std::map<uint64_t, std::vector<range> > owned;
+  std::vector<eh_frame> eh_frames;
+
+  stats s;
+
+  chunk *map_chunk(pool_kind kind, uint64_t min_size)
+  {
+    bool huge = huge_pages && kind == pool_code;
+    uint64_t align = huge ? huge_page_size : page_size;
+    uint64_t size = chunk_size;
+    if (min_size > size)
+      size = (min_size + align - 1) / align * align;
+
+    int prot = PROT_READ | PROT_WRITE | (huge ? PROT_EXEC : 0);
+    void *base = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages if the system has reserved some.
+    if (huge)
+      base = mmap(0, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    if (base == MAP_FAILED)
+    {
+      base = mmap(0, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (base == MAP_FAILED)
+        return 0;
+#ifdef MADV_HUGEPAGE
+      // Otherwise ask for transparent huge pages.
+      if (huge)
+        madvise(base, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    chunk *c = new chunk;
+    c->base = (uint8_t *)base;
+    c->size = size;
+    c->cursor = 0;
+    c->protected_upto = 0;
+    c->live = 0;
+    c->page_live.resize(size / page_size);
+    pools[kind].chunks.push_back(c);
+    s.reserved += size;
+    return c;
+  }
+
+  /// is_protected - Whether finalizeMemory changes the protection of the
+  /// pool, which it can only do for whole pages.
+  bool is_protected(pool_kind kind)
+  {
+    return kind == pool_rodata || (kind == pool_code && !huge_pages);
+  }
+
+  uint64_t round_to_page(uint64_t offset)
+  {
+    return (offset + page_size - 1) / page_size * page_size;
+  }
+
+  /// add_live - Count [begin, end) as live on the pages it covers.
+  void add_live(chunk *c, uint64_t begin, uint64_t end)
+  {
+    for (uint64_t page = begin / page_size; page * page_size < end; page++)
+      c->page_live[page] += std::min(end, (page + 1) * page_size) - std::max(begin, page * page_size);
+  }
+
+  /// take_free - First fit from the free list of the pool. In protected
+  /// pools the extent is made writable again, whole pages at a time.
+  bool take_free(pool_kind kind, uint64_t size, unsigned alignment, chunk *&c, uint64_t &begin)
+  {
+    pool &p = pools[kind];
+    for (size_t i = 0; i < p.free.size(); i++)
+    {
+      extent &e = p.free[i];
+      uint64_t b = (e.begin + alignment - 1) / alignment * alignment;
+      if (b + size > e.end)
+        continue;
+
+      uint64_t end = b + size;
+      if (is_protected(kind))
+      {
+        end = round_to_page(end);
+        mprotect(e.where->base + e.begin, end - e.begin, PROT_READ | PROT_WRITE);
+      }
+      extent used = { e.where, e.begin, end };
+      p.pending.push_back(used);
+      s.wasted += (end - e.begin) - size;
+
+      c = e.where;
+      begin = b;
+      if (end == e.end)
+        p.free.erase(p.free.begin() + i);
+      else
+        e.begin = end;
+      return true;
+    }
+    return false;
+  }
+
+  /// add_free - Put a released extent on the free list, merged with its
+  /// neighbours.
+  void add_free(pool_kind kind, chunk *c, uint64_t begin, uint64_t end)
+  {
+    std::vector<extent> &free = pools[kind].free;
+    size_t i = 0;
+    while (i < free.size() && (free[i].where < c || (free[i].where == c && free[i].end < begin)))
+      i++;
+
+    if (i < free.size() && free[i].where == c && free[i].end == begin)
+    {
+      free[i].end = end;
+      if (i + 1 < free.size() && free[i + 1].where == c && free[i + 1].begin == end)
+      {
+        free[i].end = free[i + 1].end;
+        free.erase(free.begin() + i + 1);
+      }
+      return;
+    }
+    if (i < free.size() && free[i].where == c && free[i].begin == end)
+    {
+      free[i].begin = begin;
+      return;
+    }
+    extent e = { c, begin, end };
+    free.insert(free.begin() + i, e);
+  }
+
+  /// forget_chunk - Drop the free and pending extents of an unmapped chunk.
+  void forget_chunk(pool &p, chunk *c)
+  {
+    for (size_t i = 0; i < p.free.size(); i++)
+      if (p.free[i].where == c)
+        p.free.erase(p.free.begin() + i--);
+    for (size_t i = 0; i < p.pending.size(); i++)
+      if (p.pending[i].where == c)
+        p.pending.erase(p.pending.begin() + i--);
+  }
+
+  uint8_t *allocate(pool_kind kind, uintptr_t size, unsigned alignment)
+  {
+    if (!alignment)
+      alignment = 16;
+
+    pool &p = pools[kind];
+    chunk *c = 0;
+    uint64_t begin = 0;
+    uint64_t from = 0; // start of the allocation including its padding
+
+    if (take_free(kind, size, alignment, c, begin))
+      from = begin;
+    else
+    {
+      c = p.chunks.empty() ? 0 : p.chunks.back();
+      if (c)
+        begin = (c->cursor + alignment - 1) / alignment * alignment;
+
+      if (!c || begin + size > c->size)
+      {
+        c = map_chunk(kind, size + alignment);
+        if (!c)
+          return 0;
+        begin = 0;
+      }
+
+      from = c->cursor;
+      s.wasted += begin - c->cursor;
+      c->cursor = begin + size;
+    }
+    s.used += size;
+
+    // A range grown by a following allocation includes the padding between
+    // them, which is counted as live with it.
+    std::vector<range> &ranges = owned[current_owner];
+    bool grow = !ranges.empty() && ranges.back().where == c && ranges.back().end == from;
+    add_live(c, grow ? from : begin, begin + size);
+
+    if (grow)
+    {
+      ranges.back().end = begin + size;
+      ranges.back().used += size;
+    }
+    else
+    {
+      range r = { kind, c, begin, begin + size, size };
+      ranges.push_back(r);
+    }
+
+    c->live += size;
+    return c->base + begin;
+  }
+
+  /// protect - Apply the final protection to everything allocated since the
+  /// last finalize. Protected pools continue on a new page afterwards.
+  void protect(pool_kind kind, int prot)
+  {
+    pool &p = pools[kind];
+    bool whole_pages = is_protected(kind);
+    for (size_t i = 0; i < p.chunks.size(); i++)
+    {
+      chunk *c = p.chunks[i];
+      uint64_t end = c->cursor;
+      if (whole_pages)
+        end = std::min(round_to_page(end), c->size);
+      if (end <= c->protected_upto)
+        continue;
+
+      if (kind == pool_code)
+        llvm::sys::Memory::InvalidateInstructionCache(c->base + c->protected_upto, end - c->protected_upto);
+      if (whole_pages)
+        mprotect(c->base + c->protected_upto, end - c->protected_upto, prot);
+
+      s.wasted += end - c->cursor;
+      c->cursor = end;
+      c->protected_upto = end;
+    }
+
+    for (size_t i = 0; i < p.pending.size(); i++)
+    {
+      extent &e = p.pending[i];
+      if (kind == pool_code)
+        llvm::sys::Memory::InvalidateInstructionCache(e.where->base + e.begin, e.end - e.begin);
+      if (whole_pages)
+        mprotect(e.where->base + e.begin, e.end - e.begin, prot);
+    }
+    p.pending.clear();
+  }
+
+public:
+
+  jit_memory_manager(bool use_huge_pages = false)
+    : huge_pages(use_huge_pages)
+  {
+    page_size = sysconf(_SC_PAGESIZE);
+  }
+
+  ~jit_memory_manager()
+  {
+    for (unsigned k = 0; k < pool_count; k++)
+      for (size_t i = 0; i < pools[k].chunks.size(); i++)
+      {
+        munmap(pools[k].chunks[i]->base, pools[k].chunks[i]->size);
+        delete pools[k].chunks[i];
+      }
+  }
+
+  void add_symbol(const std::string &name, void *address)
+  {
+    symbols[name] = (uint64_t)(uintptr_t)address;
+  }
+
+  uint64_t get_symbol(const std::string &name)
+  {
+    std::map<std::string, uint64_t>::iterator it = symbols.find(name);
+    if (it == symbols.end())
+      return 0;
+    return it->second;
+  }
+
+  /// begin_owner - Attribute the following allocations to a new owner.
+  uint64_t begin_owner()
+  {
+    current_owner = next_owner++;
+    return current_owner;
+  }
+
+  /// release - Give back the memory of an owner whose code can no longer be
+  /// reached.
+  void release(uint64_t owner)
+  {
+    std::map<uint64_t, std::vector<range> >::iterator it = owned.find(owner);
+    if (it == owned.end())
+      return;
+
+    std::vector<range> &ranges = it->second;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+      range &r = ranges[i];
+      chunk *c = r.where;
+
+      // Unwind info of released code must not be found anymore.
+      for (size_t f = 0; f < eh_frames.size(); f++)
+        if (eh_frames[f].addr >= c->base + r.begin && eh_frames[f].addr < c->base + r.end)
+        {
+          llvm::RTDyldMemoryManager::deregisterEHFrames(eh_frames[f].addr, eh_frames[f].load_addr, eh_frames[f].size);
+          eh_frames.erase(eh_frames.begin() + f--);
+        }
+
+      // Pages nothing is live on anymore go back to the system, except on
+      // the huge page pool where that would split the huge pages. Pages
+      // the cursor has not passed yet are still being filled. Protected
+      // pools can only reuse whole pages, other pools the whole range.
+      for (uint64_t page = r.begin / page_size; page * page_size < r.end; page++)
+      {
+        uint64_t from = page * page_size;
+        uint64_t to = from + page_size;
+        c->page_live[page] -= std::min(r.end, to) - std::max(r.begin, from);
+        if (c->page_live[page] || to > c->cursor)
+          continue;
+
+        if (!(huge_pages && r.pool == pool_code))
+        {
+          madvise(c->base + from, page_size, MADV_DONTNEED);
+          s.returned += page_size;
+        }
+        if (is_protected(r.pool))
+          add_free(r.pool, c, from, to);
+      }
+      if (!is_protected(r.pool))
+        add_free(r.pool, c, r.begin, r.end);
+
+      s.used -= r.used;
+      s.freed += r.used;
+      c->live -= r.used;
+
+      // Unmap chunks that are neither live nor the one being filled.
+      pool &p = pools[r.pool];
+      if (!c->live && c != p.chunks.back())
+      {
+        for (size_t j = 0; j < p.chunks.size(); j++)
+          if (p.chunks[j] == c)
+            p.chunks.erase(p.chunks.begin() + j);
+        forget_chunk(p, c);
+        munmap(c->base, c->size);
+        s.reserved -= c->size;
+        delete c;
+      }
+    }
+    owned.erase(it);
+  }
+
+  /// get_code_bytes - Bytes of code allocated for owner.
+  uint64_t get_code_bytes(uint64_t owner)
+  {
+    uint64_t bytes = 0;
+    std::map<uint64_t, std::vector<range> >::iterator it = owned.find(owner);
+    if (it != owned.end())
+      for (size_t i = 0; i < it->second.size(); i++)
+        if (it->second[i].pool == pool_code)
+          bytes += it->second[i].used;
+    return bytes;
+  }
+
+  const stats &get_stats()
+  {
+    return s;
+  }
+
+  void print_stats()
+  {
+    fprintf(stderr, "JIT memory: %llu bytes reserved, %llu used, %llu wasted, %llu freed, "
+                    "%llu returned%s\n",
+            (unsigned long long)s.reserved, (unsigned long long)s.used,
+            (unsigned long long)s.wasted, (unsigned long long)s.freed,
+            (unsigned long long)s.returned,
+            huge_pages ? " (huge pages for code)" : "");
+  }
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, llvm::StringRef SectionName) override
+  {
+    return allocate(pool_code, Size, Alignment);
+  }
+
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, llvm::StringRef SectionName,
+                               bool IsReadOnly) override
+  {
+    return allocate(IsReadOnly ? pool_rodata : pool_data, Size, Alignment);
+  }
+
+  bool finalizeMemory(std::string *ErrMsg) override
+  {
+    protect(pool_code, huge_pages ? (PROT_READ | PROT_WRITE | PROT_EXEC) : (PROT_READ | PROT_EXEC));
+    protect(pool_rodata, PROT_READ);
+    protect(pool_data, PROT_READ | PROT_WRITE);
+    return false;
+  }
+
+  void registerEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size) override
+  {
+    eh_frame f = { Addr, LoadAddr, Size };
+    eh_frames.push_back(f);
+    llvm::RTDyldMemoryManager::registerEHFrames(Addr, LoadAddr, Size);
+  }
+
+  uint64_t getSymbolAddress(const std::string &Name) override
+  {
+    if (uint64_t Address = get_symbol(Name))
+      return Address;
+
+    return llvm::RTDyldMemoryManager::getSymbolAddress(Name);
+  }
+};
+
+#endif
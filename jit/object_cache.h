@@ -0,0 +1,207 @@
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "llvm_includes.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// object_cache - On disk cache of the machine code MCJIT emits per module.
+///
+/// Objects are stored as <dir>/<md5>.o, keyed by the optimized IR of the
+/// module, the optimization level and the target CPU and features. A hit
+/// touches the file. The size of the directory is scanned once and then kept
+/// up to date by the stores; when a store takes it over the size limit the
+/// directory is scanned again and the least recently used objects are
+/// evicted down to 90% of the limit, so scans stay rare. Safe to use from
+/// the background compile threads.
+class object_cache : public llvm::ObjectCache
+{
+  std::string dir;
+  uint64_t max_bytes = 0;
+  uint64_t total_bytes = 0; // size of the objects in dir, as far as we know
+  std::string target; // opt level, cpu and features, part of every key
+
+  // Keys computed by getObject, reused by notifyObjectCompiled.
+  std::map<const llvm::Module *, std::string> keys;
+
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t bytes_loaded = 0;
+  uint64_t bytes_stored = 0;
+
+  std::mutex mutex;
+
+  std::string get_key(const llvm::Module *M)
+  {
+    std::map<const llvm::Module *, std::string>::iterator it = keys.find(M);
+    if (it != keys.end())
+      return it->second;
+
+    std::string IR;
+    llvm::raw_string_ostream OS(IR);
+    M->print(OS, 0);
+    OS.flush();
+
+    llvm::MD5 Hash;
+    Hash.update(target);
+    Hash.update(IR);
+    llvm::MD5::MD5Result Result;
+    Hash.final(Result);
+
+    llvm::SmallString<32> Key;
+    llvm::MD5::stringifyResult(Result, Key);
+    return keys[M] = Key.str();
+  }
+
+  std::string get_path(const std::string &key)
+  {
+    return dir + "/" + key + ".o";
+  }
+
+  /// scan - The objects in dir with their modification time, and their
+  /// total size.
+  uint64_t scan(std::vector< std::pair<time_t, std::string> > &files)
+  {
+    uint64_t total = 0;
+    DIR *D = opendir(dir.c_str());
+    if (!D)
+      return 0;
+
+    while (struct dirent *E = readdir(D))
+    {
+      std::string name = E->d_name;
+      if (name.size() < 2 || name.compare(name.size() - 2, 2, ".o"))
+        continue;
+
+      struct stat st;
+      std::string path = dir + "/" + name;
+      if (stat(path.c_str(), &st))
+        continue;
+      total += st.st_size;
+      files.push_back(std::make_pair(st.st_mtime, path));
+    }
+    closedir(D);
+    return total;
+  }
+
+  /// evict - Remove the least recently used objects until the cache is at
+  /// 90% of its limit. Other processes sharing dir are picked up here too.
+  void evict()
+  {
+    std::vector< std::pair<time_t, std::string> > files;
+    uint64_t total = scan(files);
+    uint64_t target = max_bytes / 10 * 9;
+
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size() && total > target; i++)
+    {
+      struct stat st;
+      if (stat(files[i].second.c_str(), &st) || unlink(files[i].second.c_str()))
+        continue;
+      total -= st.st_size;
+      evictions++;
+    }
+    total_bytes = total;
+  }
+
+public:
+
+  /// init - Use dir for cached objects, creating it if needed.
+  void init(const std::string &cache_dir, uint64_t max_size, const std::string &target_key)
+  {
+    dir = cache_dir;
+    max_bytes = max_size;
+    target = target_key;
+    mkdir(dir.c_str(), 0755);
+
+    std::lock_guard<std::mutex> Lock(mutex);
+    std::vector< std::pair<time_t, std::string> > files;
+    total_bytes = scan(files);
+    if (total_bytes > max_bytes)
+      evict();
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    std::string path = get_path(get_key(M));
+
+    llvm::ErrorOr< std::unique_ptr<llvm::MemoryBuffer> > Buffer =
+        llvm::MemoryBuffer::getFile(path, -1, false);
+    if (!Buffer)
+    {
+      misses++;
+      return nullptr;
+    }
+
+    // Mark it as recently used.
+    utime(path.c_str(), 0);
+
+    hits++;
+    bytes_loaded += (*Buffer)->getBufferSize();
+    keys.erase(M);
+    return std::move(*Buffer);
+  }
+
+  void notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj) override
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    std::string path = get_path(get_key(M));
+    keys.erase(M);
+
+    // Write next to the final name and rename, so readers never see a
+    // partial object.
+    std::string tmp = path + ".tmp" + std::to_string((long long)getpid());
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+      return;
+    bool ok = fwrite(Obj.getBufferStart(), 1, Obj.getBufferSize(), f) == Obj.getBufferSize();
+    ok = !fclose(f) && ok;
+    // An object stored by another process under the same key is replaced.
+    struct stat st;
+    uint64_t replaced = stat(path.c_str(), &st) ? 0 : st.st_size;
+    if (!ok || rename(tmp.c_str(), path.c_str()))
+    {
+      unlink(tmp.c_str());
+      return;
+    }
+
+    bytes_stored += Obj.getBufferSize();
+    total_bytes += Obj.getBufferSize();
+    total_bytes -= std::min(total_bytes, replaced);
+    if (total_bytes > max_bytes)
+      evict();
+  }
+
+  void print_stats()
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    fprintf(stderr, "Object cache: %llu hits, %llu misses, %llu evictions, %llu bytes loaded, %llu bytes stored\n",
+            (unsigned long long)hits, (unsigned long long)misses, (unsigned long long)evictions,
+            (unsigned long long)bytes_loaded, (unsigned long long)bytes_stored);
+  }
+
+  static object_cache* get_instance()
+  {
+    static object_cache oc;
+    return &oc;
+  }
+};
+
+#endif
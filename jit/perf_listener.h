@@ -0,0 +1,297 @@
+#ifndef PERF_LISTENER_H
+#define PERF_LISTENER_H
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "llvm_includes.h"
+#include "llvm/DebugInfo/DIContext.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/Object/ObjectFile.h"
+
+/// perf_listener - Makes JIT code visible to Linux perf.
+///
+/// -perf-map appends "start size name" for every function to
+/// /tmp/perf-<pid>.map, which perf report reads to name samples in
+/// anonymous memory.
+///
+/// -jitdump writes ./jit-<pid>.dump in the jitdump format, with the code and
+/// the line table of every function taken from its DWARF. After
+///
+///   perf record -k 1 ./toy -jitdump prog.k
+///   perf inject --jit -i perf.data -o perf.jit.data
+///
+/// perf report and perf annotate attribute samples to Kaleidoscope functions
+/// and source lines.
+///
+/// MCJIT reports objects before their relocations are applied, so the
+/// functions are collected and written by flush, once the code is final.
+class perf_listener : public llvm::JITEventListener
+{
+  struct line
+  {
+    uint64_t address;
+    uint32_t line;
+    std::string file;
+  };
+
+  struct function
+  {
+    std::string name;
+    uint64_t address;
+    uint64_t size;
+    std::vector<line> lines;
+  };
+
+  // jitdump records, see tools/perf/Documentation/jitdump-specification.txt
+  // in the Linux sources.
+  enum
+  {
+    jit_code_load = 0,
+    jit_code_debug_info = 2
+  };
+
+  struct jitdump_header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+  };
+
+  struct record_header
+  {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+  };
+
+  FILE *map = 0;
+  FILE *dump = 0;
+  void *marker = 0;
+  size_t marker_size = 0;
+  uint64_t code_index = 0;
+
+  std::vector<function> loaded;
+
+  static uint64_t timestamp()
+  {
+    // perf record -k 1 samples with CLOCK_MONOTONIC.
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  static uint32_t elf_machine()
+  {
+#if defined(__x86_64__)
+    return EM_X86_64;
+#elif defined(__i386__)
+    return EM_386;
+#elif defined(__aarch64__)
+    return EM_AARCH64;
+#elif defined(__arm__)
+    return EM_ARM;
+#else
+    return EM_NONE;
+#endif
+  }
+
+  bool open_jitdump()
+  {
+    char path[64];
+    snprintf(path, sizeof(path), "jit-%d.dump", (int)getpid());
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0)
+      return false;
+
+    // perf finds the dump through this executable mapping of it.
+    marker_size = sysconf(_SC_PAGESIZE);
+    marker = mmap(0, marker_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (marker == MAP_FAILED)
+    {
+      marker = 0;
+      close(fd);
+      return false;
+    }
+
+    dump = fdopen(fd, "wb");
+    if (!dump)
+      return false;
+
+    jitdump_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = 0x4A695444; // "JiTD"
+    h.version = 1;
+    h.total_size = sizeof(h);
+    h.elf_mach = elf_machine();
+    h.pid = getpid();
+    h.timestamp = timestamp();
+    fwrite(&h, sizeof(h), 1, dump);
+    return true;
+  }
+
+  void write_debug_info(const function &f)
+  {
+    if (f.lines.empty())
+      return;
+
+    uint64_t size = sizeof(record_header) + 2 * sizeof(uint64_t);
+    for (size_t i = 0; i < f.lines.size(); i++)
+      size += sizeof(uint64_t) + 2 * sizeof(uint32_t) + f.lines[i].file.size() + 1;
+
+    record_header r = { jit_code_debug_info, (uint32_t)size, timestamp() };
+    uint64_t entries = f.lines.size();
+    fwrite(&r, sizeof(r), 1, dump);
+    fwrite(&f.address, sizeof(uint64_t), 1, dump);
+    fwrite(&entries, sizeof(uint64_t), 1, dump);
+    for (size_t i = 0; i < f.lines.size(); i++)
+    {
+      uint32_t discriminator = 0;
+      fwrite(&f.lines[i].address, sizeof(uint64_t), 1, dump);
+      fwrite(&f.lines[i].line, sizeof(uint32_t), 1, dump);
+      fwrite(&discriminator, sizeof(uint32_t), 1, dump);
+      fwrite(f.lines[i].file.c_str(), f.lines[i].file.size() + 1, 1, dump);
+    }
+  }
+
+  void write_code_load(const function &f)
+  {
+    uint32_t pid = getpid();
+    uint32_t tid = syscall(SYS_gettid);
+    uint64_t size = sizeof(record_header) + 2 * sizeof(uint32_t) + 4 * sizeof(uint64_t) +
+                    f.name.size() + 1 + f.size;
+
+    record_header r = { jit_code_load, (uint32_t)size, timestamp() };
+    fwrite(&r, sizeof(r), 1, dump);
+    fwrite(&pid, sizeof(pid), 1, dump);
+    fwrite(&tid, sizeof(tid), 1, dump);
+    fwrite(&f.address, sizeof(uint64_t), 1, dump); // vma
+    fwrite(&f.address, sizeof(uint64_t), 1, dump); // code_addr
+    fwrite(&f.size, sizeof(uint64_t), 1, dump);
+    fwrite(&code_index, sizeof(uint64_t), 1, dump);
+    fwrite(f.name.c_str(), f.name.size() + 1, 1, dump);
+    fwrite((const void *)(uintptr_t)f.address, f.size, 1, dump);
+    code_index++;
+  }
+
+public:
+
+  ~perf_listener()
+  {
+    if (map)
+      fclose(map);
+    if (dump)
+      fclose(dump);
+    if (marker)
+      munmap(marker, marker_size);
+  }
+
+  /// init - Open the perf map and/or the jitdump. Returns false if a file
+  /// could not be created.
+  bool init(bool perf_map, bool jitdump)
+  {
+    if (perf_map)
+    {
+      char path[64];
+      snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+      map = fopen(path, "w");
+      if (!map)
+        return false;
+    }
+    return !jitdump || open_jitdump();
+  }
+
+  bool is_enabled()
+  {
+    return map || dump;
+  }
+
+  void NotifyObjectEmitted(const llvm::object::ObjectFile &Obj,
+                           const llvm::RuntimeDyld::LoadedObjectInfo &L) override
+  {
+    // The debug object has its sections at their load addresses.
+    llvm::object::OwningBinary<llvm::object::ObjectFile> DebugObjOwner = L.getObjectForDebug(Obj);
+    const llvm::object::ObjectFile *DebugObj = DebugObjOwner.getBinary();
+    if (!DebugObj)
+      return;
+
+    std::unique_ptr<llvm::DIContext> Context;
+    if (dump)
+      Context.reset(llvm::DIContext::getDWARFContext(*DebugObj));
+
+    for (llvm::object::symbol_iterator I = DebugObj->symbol_begin(), E = DebugObj->symbol_end(); I != E; ++I)
+    {
+      llvm::object::SymbolRef::Type Type;
+      llvm::StringRef Name;
+      uint64_t Address, Size;
+      if (I->getType(Type) || Type != llvm::object::SymbolRef::ST_Function ||
+          I->getName(Name) || I->getAddress(Address) || I->getSize(Size) || !Size)
+        continue;
+
+      function f;
+      f.name = Name;
+      f.address = Address;
+      f.size = Size;
+
+      if (Context)
+      {
+        llvm::DILineInfoTable Lines = Context->getLineInfoForAddressRange(
+              Address, Size, llvm::DILineInfoSpecifier(
+                llvm::DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath));
+        for (llvm::DILineInfoTable::iterator L = Lines.begin(), LE = Lines.end(); L != LE; ++L)
+        {
+          line l = { L->first, L->second.Line, L->second.FileName };
+          f.lines.push_back(l);
+        }
+      }
+      loaded.push_back(f);
+    }
+  }
+
+  /// flush - Write out the functions loaded since the last flush. Called
+  /// once their code is finalized.
+  void flush()
+  {
+    for (size_t i = 0; i < loaded.size(); i++)
+    {
+      const function &f = loaded[i];
+      if (map)
+        fprintf(map, "%llx %llx %s\n", (unsigned long long)f.address,
+                (unsigned long long)f.size, f.name.c_str());
+      if (dump)
+      {
+        write_debug_info(f);
+        write_code_load(f);
+      }
+    }
+    loaded.clear();
+
+    if (map)
+      fflush(map);
+    if (dump)
+      fflush(dump);
+  }
+
+  static perf_listener* get_instance()
+  {
+    static perf_listener l;
+    return &l;
+  }
+};
+
+#endif
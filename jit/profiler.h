@@ -0,0 +1,251 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm_includes.h"
+#include "llvm_helper.h"
+#include "module_manager.h"
+#include "builder_manager.h"
+#include "compilation_context.h"
+#include "options.h"
+#include "jit/jit_engine.h"
+
+/// profiler - Call counters and cycle accounting compiled into JIT code
+/// (-profile), and iteration counters for loops (-profile-loops).
+///
+/// Every function counts its calls and the cycles (llvm.readcyclecounter)
+/// spent in it including callees. Recursive calls only add cycles at the
+/// outermost level, so inclusive times are not counted twice. Loops count
+/// how often they are entered and how many iterations they run; the count is
+/// kept in a register and added to the table when the loop exits.
+///
+/// The counters live in host tables, one compact record per function and
+/// loop, which generated code reaches by symbol (__kaleidoscope_prof.*) like
+/// the dispatch slots, so instrumented objects stay cacheable. dump prints a
+/// flat profile. The tables are shared by all compilation contexts, whose
+/// symbols differ by their prefix, and are locked since contexts generate
+/// code in parallel.
+class profiler
+{
+public:
+
+  struct function_record
+  {
+    uint64_t calls;
+    uint64_t cycles; // inclusive
+    uint64_t depth;  // active calls
+  };
+
+  struct loop_record
+  {
+    uint64_t entries;
+    uint64_t iterations;
+  };
+
+private:
+
+  // Deques, so record addresses stay stable as they grow.
+  std::mutex mutex;
+  std::deque<function_record> functions;
+  std::deque<loop_record> loops;
+  std::map<std::string, function_record *> function_by_symbol;
+  std::map<std::string, loop_record *> loop_by_symbol;
+
+  function_record *get_function_record(const std::string &symbol)
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    std::map<std::string, function_record *>::iterator it = function_by_symbol.find(symbol);
+    if (it != function_by_symbol.end())
+      return it->second;
+
+    function_record r = { 0, 0, 0 };
+    functions.push_back(r);
+    function_by_symbol[symbol] = &functions.back();
+    jit_engine::get_instance()->add_host_symbol(symbol, &functions.back());
+    return &functions.back();
+  }
+
+  loop_record *get_loop_record(const std::string &symbol)
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    std::map<std::string, loop_record *>::iterator it = loop_by_symbol.find(symbol);
+    if (it != loop_by_symbol.end())
+      return it->second;
+
+    loop_record r = { 0, 0 };
+    loops.push_back(r);
+    loop_by_symbol[symbol] = &loops.back();
+    jit_engine::get_instance()->add_host_symbol(symbol, &loops.back());
+    return &loops.back();
+  }
+
+  static std::string function_symbol(const std::string &function)
+  {
+    return "__kaleidoscope_prof." + function;
+  }
+
+  static std::string loop_symbol(const std::string &function, int line, int col)
+  {
+    return "__kaleidoscope_prof." + function + ":" + std::to_string((long long)line) +
+           ":" + std::to_string((long long)col);
+  }
+
+  static const char *strip_prefix(const std::string &symbol)
+  {
+    return symbol.c_str() + function_symbol("").size();
+  }
+
+public:
+
+  // Helpers for counters in host records, also used by pgo.
+
+  static llvm::Type *get_int64()
+  {
+    return llvm::Type::getInt64Ty(compilation_context::current()->get_llvm_context());
+  }
+
+  /// get_record - The global for record symbol in the current module, an
+  /// array of count i64.
+  static llvm::Constant *get_record(const std::string &symbol, unsigned count)
+  {
+    llvm::Module *M = module_manager::get_instance()->get();
+    return M->getOrInsertGlobal(symbol, llvm::ArrayType::get(get_int64(), count));
+  }
+
+  /// add - record[field] += Value
+  static void add(llvm::Constant *Record, unsigned field, llvm::Value *Value, const char *Name)
+  {
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    llvm::Value *Field = Builder->CreateConstInBoundsGEP2_64(Record, 0, field);
+    llvm::Value *Old = Builder->CreateLoad(Field, Name);
+    Builder->CreateStore(Builder->CreateAdd(Old, Value), Field);
+  }
+
+  static llvm::Value *read_cycles()
+  {
+    llvm::Module *M = module_manager::get_instance()->get();
+    llvm::Function *Counter = llvm::Intrinsic::getDeclaration(M, llvm::Intrinsic::readcyclecounter);
+    return builder_manager::get_instance()->get_ir()->CreateCall(Counter, "prof.cycles");
+  }
+
+  /// emit_function_entry - Count a call of the function being generated and
+  /// return its start time. Emitted at the end of the entry block.
+  llvm::Value *emit_function_entry()
+  {
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    std::string symbol = function_symbol(Builder->GetInsertBlock()->getParent()->getName());
+    get_function_record(symbol);
+
+    llvm::Constant *Record = get_record(symbol, 3);
+    add(Record, 0, llvm::ConstantInt::get(get_int64(), 1), "prof.calls");
+    add(Record, 2, llvm::ConstantInt::get(get_int64(), 1), "prof.depth");
+    return read_cycles();
+  }
+
+  /// emit_function_exit - Account the cycles since Start when the outermost
+  /// active call of the function returns.
+  void emit_function_exit(llvm::Value *Start)
+  {
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    std::string symbol = function_symbol(Builder->GetInsertBlock()->getParent()->getName());
+    llvm::Constant *Record = get_record(symbol, 3);
+
+    llvm::Value *Elapsed = Builder->CreateSub(read_cycles(), Start, "prof.elapsed");
+
+    llvm::Value *DepthField = Builder->CreateConstInBoundsGEP2_64(Record, 0, 2);
+    llvm::Value *Depth = Builder->CreateSub(Builder->CreateLoad(DepthField, "prof.depth"),
+                                            llvm::ConstantInt::get(get_int64(), 1));
+    Builder->CreateStore(Depth, DepthField);
+
+    llvm::Value *Outermost = Builder->CreateICmpEQ(Depth, llvm::ConstantInt::get(get_int64(), 0));
+    add(Record, 1, Builder->CreateSelect(Outermost, Elapsed, llvm::ConstantInt::get(get_int64(), 0)),
+        "prof.total");
+  }
+
+  /// begin_loop - Set up the iteration count of a loop, emitted before the
+  /// loop is entered.
+  llvm::AllocaInst *begin_loop()
+  {
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+    llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
+    llvm::AllocaInst *Count = TmpB.CreateAlloca(get_int64(), 0, "prof.iterations");
+    Builder->CreateStore(llvm::ConstantInt::get(get_int64(), 0), Count);
+    return Count;
+  }
+
+  /// count_iteration - Emitted at the start of every iteration.
+  void count_iteration(llvm::AllocaInst *Count)
+  {
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    Builder->CreateStore(Builder->CreateAdd(Builder->CreateLoad(Count),
+                                            llvm::ConstantInt::get(get_int64(), 1)), Count);
+  }
+
+  /// end_loop - Add the iteration count to the loop's record, emitted in the
+  /// loop exit block.
+  void end_loop(llvm::AllocaInst *Count, int line, int col)
+  {
+    llvm::IRBuilder<> *Builder = builder_manager::get_instance()->get_ir();
+    std::string symbol = loop_symbol(Builder->GetInsertBlock()->getParent()->getName(), line, col);
+    get_loop_record(symbol);
+
+    llvm::Constant *Record = get_record(symbol, 2);
+    add(Record, 0, llvm::ConstantInt::get(get_int64(), 1), "prof.entries");
+    add(Record, 1, Builder->CreateLoad(Count), "prof.iterations");
+  }
+
+  /// dump - Print the flat profile, hottest functions and loops first.
+  void dump()
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    std::vector< std::pair<uint64_t, std::string> > order;
+    for (std::map<std::string, function_record *>::iterator it = function_by_symbol.begin();
+         it != function_by_symbol.end(); ++it)
+      order.push_back(std::make_pair(it->second->cycles, it->first));
+    std::sort(order.rbegin(), order.rend());
+
+    fprintf(stderr, "%14s %18s %14s  %s\n", "calls", "cycles (incl.)", "cycles/call", "function");
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const function_record &r = *function_by_symbol[order[i].second];
+      fprintf(stderr, "%14llu %18llu %14.1f  %s\n",
+              (unsigned long long)r.calls, (unsigned long long)r.cycles,
+              r.calls ? (double)r.cycles / r.calls : 0.0, strip_prefix(order[i].second));
+    }
+
+    if (loop_by_symbol.empty())
+      return;
+
+    order.clear();
+    for (std::map<std::string, loop_record *>::iterator it = loop_by_symbol.begin();
+         it != loop_by_symbol.end(); ++it)
+      order.push_back(std::make_pair(it->second->iterations, it->first));
+    std::sort(order.rbegin(), order.rend());
+
+    fprintf(stderr, "\n%14s %18s %14s  %s\n", "entries", "iterations", "per entry", "loop");
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const loop_record &r = *loop_by_symbol[order[i].second];
+      fprintf(stderr, "%14llu %18llu %14.1f  %s\n",
+              (unsigned long long)r.entries, (unsigned long long)r.iterations,
+              r.entries ? (double)r.iterations / r.entries : 0.0, strip_prefix(order[i].second));
+    }
+  }
+
+  static profiler* get_instance()
+  {
+    static profiler p;
+    return &p;
+  }
+};
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef TIERING_H
+#define TIERING_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "evaluator.h"
+#include "function_registry.h"
+#include "options.h"
+#include "jit/jit_engine.h"
+
+/// tiering - Promotion of hot functions from the interpreter to the JIT.
+///
+/// Functions start out interpreted (evaluator in run mode). Calls and loop
+/// back edges are counted per function; once a function crosses a threshold
+/// it is queued for a background worker, which compiles it and publishes the
+/// code in its dispatch slot. From then on calls from compiled code and from
+/// the interpreter go straight to the compiled code. There is no on stack
+/// replacement, running interpreted calls finish in the interpreter.
+///
+/// The counts are kept per compilation context, by the thread running its
+/// program; one worker compiles for all of them.
+class tiering
+{
+public:
+
+  struct function_profile
+  {
+    uint64_t calls = 0;
+    uint64_t back_edges = 0;
+    bool queued = false;
+  };
+
+  typedef std::map<vsx_string<>, function_profile> profile_map;
+
+private:
+
+  std::thread worker;
+  std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  std::deque<jit_slot *> queue;
+  bool stopping = false;
+
+  static profile_map &get_profiles()
+  {
+    return *compilation_context::current()->get<profile_map>(compilation_context::c_tiering);
+  }
+
+  void run_worker()
+  {
+    for (;;)
+    {
+      jit_slot *slot;
+      {
+        std::unique_lock<std::mutex> Lock(queue_mutex);
+        queue_cv.wait(Lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty())
+          return;
+        slot = queue.front();
+        queue.pop_front();
+      }
+
+      std::chrono::high_resolution_clock::time_point Start = std::chrono::high_resolution_clock::now();
+      jit_engine::get_instance()->compile_slot(slot);
+      fprintf(stderr, "Promoted %s to the JIT in %.3f ms\n",
+              jit_engine::get_instance()->get_slot_info(slot).key.c_str(),
+              std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - Start).count());
+    }
+  }
+
+  void promote(const vsx_string<> &name, function_profile &profile)
+  {
+    if (profile.queued)
+      return;
+    profile.queued = true;
+
+    jit_slot *slot = jit_engine::get_instance()->find_slot(name.c_str());
+    if (!slot)
+      return;
+
+    std::lock_guard<std::mutex> Lock(queue_mutex);
+    if (!worker.joinable())
+      worker = std::thread(&tiering::run_worker, this);
+    queue.push_back(slot);
+    queue_cv.notify_one();
+  }
+
+public:
+
+  /// count_call - Count an interpreted call of name.
+  void count_call(const vsx_string<> &name)
+  {
+    function_profile &profile = get_profiles()[name];
+    if (++profile.calls >= options::get_instance()->get_tier_calls())
+      promote(name, profile);
+  }
+
+  /// count_back_edge - Count an interpreted loop iteration in name.
+  void count_back_edge(const vsx_string<> &name)
+  {
+    function_profile &profile = get_profiles()[name];
+    if (++profile.back_edges >= options::get_instance()->get_tier_back_edges())
+      promote(name, profile);
+  }
+
+  /// call - Run a call made by compiled code through an empty dispatch slot.
+  /// Compiled code runs on the thread of its context.
+  double call(jit_slot *slot, double *args)
+  {
+    const std::string &name = jit_engine::get_instance()->get_slot_info(slot).name;
+    ast_function_prototype *P = function_registry::get_instance()->get_prototype(name.c_str());
+    std::vector<double> Args(args, args + P->getArgs().size());
+
+    evaluator *E = evaluator::get_instance();
+    bool Outer = !E->is_running();
+    if (Outer)
+      E->begin_run();
+
+    // The interpreter does not support every construct (aggregates), those
+    // calls are compiled right away. Only failures can_call cannot see get
+    // past it, e.g. an index out of bounds; compiling and calling again
+    // then is only safe if nothing native ran before the failure.
+    double Result = 0.0;
+    bool Done = false;
+    if (E->can_call(name.c_str(), Args.size()))
+    {
+      bool Before = E->had_side_effects();
+      E->set_side_effects(false);
+      Done = E->call(name.c_str(), Args, Result);
+      bool After = E->had_side_effects();
+      E->set_side_effects(Before || After);
+
+      if (!Done && After)
+      {
+        fprintf(stderr, "Interpreter gave up in %s after side effects, not running it again\n",
+                name.c_str());
+        Result = 0.0;
+        Done = true;
+      }
+    }
+
+    if (!Done)
+    {
+      uint64_t Address = jit_engine::get_instance()->compile_slot(slot);
+      if (!jit_engine::call(Address, Args, Result))
+        fprintf(stderr, "JIT: too many arguments in call to %s\n", name.c_str());
+    }
+
+    if (Outer)
+      E->end_run();
+    return Result;
+  }
+
+  /// shutdown - Let the worker finish the queued promotions and stop it.
+  void shutdown()
+  {
+    {
+      std::lock_guard<std::mutex> Lock(queue_mutex);
+      stopping = true;
+      queue_cv.notify_one();
+    }
+    if (worker.joinable())
+      worker.join();
+  }
+
+  static tiering* get_instance()
+  {
+    static tiering t;
+    return &t;
+  }
+};
+
+/// kaleidoscope_tier_call - Host callback behind every empty dispatch slot
+/// when tiering is enabled.
+extern "C" double kaleidoscope_tier_call(jit_slot *slot, double *args)
+{
+  return tiering::get_instance()->call(slot, args);
+}
+
+#endif
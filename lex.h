@@ -33,7 +33,17 @@ enum Token {
   tok_unary = -12,
 
   // var definition
-  tok_var = -13
+  tok_var = -13,
+
+  // array iteration
+  tok_foreach = -14,
+
+  // class declaration
+  tok_class = -15,
+  tok_sizeof = -16,
+
+  // prototype attribute
+  tok_fastmath = -17
 
 };
 
@@ -1,6 +1,8 @@
 #ifndef LLVM_HELPER_H
 #define LLVM_HELPER_H
 
+#include "compilation_context.h"
+
 class llvm_helper
 {
 public:
@@ -15,10 +17,30 @@ public:
   {
     llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(),
                      TheFunction->getEntryBlock().begin());
-    return TmpB.CreateAlloca(llvm::Type::getDoubleTy(llvm::getGlobalContext()), 0,
+    return TmpB.CreateAlloca(llvm::Type::getDoubleTy(compilation_context::current()->get_llvm_context()), 0,
                              VarName.c_str());
   }
 
+  /// CreateEntryBlockArrayAlloca - Create a cache line aligned [Size x double]
+  /// alloca in the entry block of the function.
+  static llvm::AllocaInst *CreateEntryBlockArrayAlloca
+  (
+      llvm::Function *TheFunction,
+      const std::string &VarName,
+      uint64_t Size
+  )
+  {
+    llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(),
+                     TheFunction->getEntryBlock().begin());
+    llvm::AllocaInst *Alloca = TmpB.CreateAlloca(
+          llvm::ArrayType::get(llvm::Type::getDoubleTy(compilation_context::current()->get_llvm_context()), Size),
+          0,
+          VarName.c_str()
+        );
+    Alloca->setAlignment(64);
+    return Alloca;
+  }
+
 };
 
 
@@ -0,0 +1,69 @@
+#ifndef LOOP_HINTS_H
+#define LOOP_HINTS_H
+
+#include "llvm_includes.h"
+#include "compilation_context.h"
+
+/// loop_hints - Optimizer hints for a single loop, attached to the latch
+/// branch as llvm.loop metadata.
+class loop_hints
+{
+  static llvm::Metadata* hint(const char* name, llvm::Type* type, uint64_t value)
+  {
+    llvm::Metadata* ops[] =
+    {
+      llvm::MDString::get( compilation_context::current()->get_llvm_context(), name ),
+      llvm::ConstantAsMetadata::get( llvm::ConstantInt::get(type, value) )
+    };
+    return llvm::MDNode::get( compilation_context::current()->get_llvm_context(), ops );
+  }
+
+public:
+
+  bool vectorize = false;
+  unsigned vectorize_width = 0;
+  unsigned interleave = 0;
+  unsigned unroll = 0;
+
+  bool empty() const
+  {
+    return !vectorize && !vectorize_width && !interleave && !unroll;
+  }
+
+  /// get_loop_id - Build the self referencing loop id node, or return 0 if
+  /// there is nothing to hint.
+  llvm::MDNode* get_loop_id() const
+  {
+    if (empty())
+      return 0;
+
+    llvm::LLVMContext &Context = compilation_context::current()->get_llvm_context();
+    llvm::Type* Int1Ty = llvm::Type::getInt1Ty(Context);
+    llvm::Type* Int32Ty = llvm::Type::getInt32Ty(Context);
+
+    llvm::SmallVector<llvm::Metadata *, 4> Args;
+
+    // Reserve operand 0 for the loop id self reference.
+    llvm::MDNode* TempNode = llvm::MDNode::getTemporary(Context, llvm::None);
+    Args.push_back(TempNode);
+
+    if (vectorize)
+      Args.push_back( hint("llvm.loop.vectorize.enable", Int1Ty, 1) );
+
+    if (vectorize_width)
+      Args.push_back( hint("llvm.loop.vectorize.width", Int32Ty, vectorize_width) );
+
+    if (interleave)
+      Args.push_back( hint("llvm.loop.interleave.count", Int32Ty, interleave) );
+
+    if (unroll)
+      Args.push_back( hint("llvm.loop.unroll.count", Int32Ty, unroll) );
+
+    llvm::MDNode* LoopID = llvm::MDNode::get(Context, Args);
+    LoopID->replaceOperandWith(0, LoopID);
+    llvm::MDNode::deleteTemporary(TempNode);
+    return LoopID;
+  }
+};
+
+#endif
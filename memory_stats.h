@@ -0,0 +1,198 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm_includes.h"
+#include "vsx_memory.h"
+
+/// memory_stats - Memory use per compile phase and per top-level item
+/// (-mem-stats).
+///
+/// Every trace_scope also measures the heap allocations made by its thread
+/// (count and bytes, counted by the global operator new in toy.cpp) and the
+/// change in resident set size. Phases nest like in the trace, so their
+/// numbers are inclusive; the totals per item only add up the outermost
+/// phases. RSS is process wide and includes the background threads.
+///
+/// On top of that each item is reported with its AST bytes (allocated while
+/// parsing it), the IR instructions generated for it and the JIT code bytes
+/// it was compiled to, to find the constructs that make long sessions grow.
+class memory_stats
+{
+public:
+
+  /// snapshot - Counters at the start of a phase.
+  struct snapshot
+  {
+    uint64_t allocations;
+    uint64_t bytes;
+    size_t rss;
+  };
+
+private:
+
+  struct phase_total
+  {
+    uint64_t count = 0;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    int64_t rss = 0;
+  };
+
+  struct item_total
+  {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    int64_t rss = 0;
+    uint64_t ast_bytes = 0;
+    uint64_t instructions = 0;
+    uint64_t code_bytes = 0;
+  };
+
+  bool enabled = false;
+
+  std::mutex mutex;
+  std::vector<const char *> order;
+  std::map<std::string, phase_total> phases;
+  std::map<std::string, item_total> items;
+
+  static unsigned &depth()
+  {
+    static thread_local unsigned d = 0;
+    return d;
+  }
+
+public:
+
+  /// allocations, allocated_bytes - Heap allocations of the calling thread.
+  static uint64_t &allocations()
+  {
+    static thread_local uint64_t n = 0;
+    return n;
+  }
+
+  static uint64_t &allocated_bytes()
+  {
+    static thread_local uint64_t n = 0;
+    return n;
+  }
+
+  /// count_allocation - Called by operator new.
+  static void count_allocation(size_t size)
+  {
+    allocations()++;
+    allocated_bytes() += size;
+  }
+
+  void init(bool on)
+  {
+    enabled = on;
+  }
+
+  bool is_enabled()
+  {
+    return enabled;
+  }
+
+  snapshot begin()
+  {
+    depth()++;
+    snapshot s = { allocations(), allocated_bytes(), vsx_memory::getCurrentRSS() };
+    return s;
+  }
+
+  /// end - Account the phase started with begin to phase and item.
+  void end(const char *phase, const std::string &item, const snapshot &start)
+  {
+    uint64_t n = allocations() - start.allocations;
+    uint64_t bytes = allocated_bytes() - start.bytes;
+    int64_t rss = (int64_t)vsx_memory::getCurrentRSS() - (int64_t)start.rss;
+    bool outermost = --depth() == 0;
+
+    std::lock_guard<std::mutex> Lock(mutex);
+    if (!phases.count(phase))
+      order.push_back(phase);
+    phase_total &p = phases[phase];
+    p.count++;
+    p.allocations += n;
+    p.bytes += bytes;
+    p.rss += rss;
+
+    item_total &i = items[item];
+    if (!strcmp(phase, "parse"))
+      i.ast_bytes += bytes;
+    if (!outermost)
+      return;
+    i.allocations += n;
+    i.bytes += bytes;
+    i.rss += rss;
+  }
+
+  /// add_instructions - Count the IR instructions of F for item.
+  void add_instructions(const std::string &item, llvm::Function *F)
+  {
+    uint64_t n = 0;
+    for (llvm::Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+      n += BB->size();
+
+    std::lock_guard<std::mutex> Lock(mutex);
+    items[item].instructions += n;
+  }
+
+  void add_code_bytes(const std::string &item, uint64_t bytes)
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    items[item].code_bytes += bytes;
+  }
+
+  /// print_summary - Totals per phase, then the items that allocated most.
+  void print_summary()
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+
+    fprintf(stderr, "%-12s %8s %12s %14s %12s\n", "phase", "count", "allocations", "alloc bytes", "rss delta");
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const phase_total &p = phases[order[i]];
+      fprintf(stderr, "%-12s %8llu %12llu %14llu %12lld\n", order[i],
+              (unsigned long long)p.count, (unsigned long long)p.allocations,
+              (unsigned long long)p.bytes, (long long)p.rss);
+    }
+
+    std::vector< std::pair<uint64_t, std::string> > by_bytes;
+    for (std::map<std::string, item_total>::iterator it = items.begin(); it != items.end(); ++it)
+      by_bytes.push_back(std::make_pair(it->second.bytes, it->first));
+    std::sort(by_bytes.rbegin(), by_bytes.rend());
+
+    const size_t shown = 20;
+    fprintf(stderr, "\n%12s %14s %12s %12s %12s %12s  %s\n", "allocations", "alloc bytes", "rss delta",
+            "ast bytes", "ir insts", "code bytes", "item");
+    for (size_t i = 0; i < by_bytes.size() && i < shown; i++)
+    {
+      const item_total &t = items[by_bytes[i].second];
+      fprintf(stderr, "%12llu %14llu %12lld %12llu %12llu %12llu  %s\n",
+              (unsigned long long)t.allocations, (unsigned long long)t.bytes, (long long)t.rss,
+              (unsigned long long)t.ast_bytes, (unsigned long long)t.instructions,
+              (unsigned long long)t.code_bytes, by_bytes[i].second.c_str());
+    }
+    if (by_bytes.size() > shown)
+      fprintf(stderr, "(%u more items)\n", (unsigned)(by_bytes.size() - shown));
+
+    fprintf(stderr, "Peak RSS: %llu bytes\n", (unsigned long long)vsx_memory::getPeakRSS());
+  }
+
+  static memory_stats* get_instance()
+  {
+    static memory_stats m;
+    return &m;
+  }
+};
+
+#endif
@@ -1,9 +1,12 @@
 #ifndef MODULE_MANAGER_H
 #define MODULE_MANAGER_H
 
+#include "compilation_context.h"
+
 class module_manager
 {
-  llvm::Module* module;
+  llvm::Module* module = 0;
+  llvm::legacy::FunctionPassManager* fpm = 0;
 public:
 
   void set(llvm::Module* n)
@@ -16,10 +19,19 @@ public:
     return module;
   }
 
+  void set_fpm(llvm::legacy::FunctionPassManager* n)
+  {
+    fpm = n;
+  }
+
+  llvm::legacy::FunctionPassManager* get_fpm()
+  {
+    return fpm;
+  }
+
   static module_manager* get_instance()
   {
-    static module_manager mm;
-    return &mm;
+    return compilation_context::current()->get<module_manager>(compilation_context::c_module);
   }
 };
 
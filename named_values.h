@@ -3,10 +3,23 @@
 
 #include "llvm_includes.h"
 #include "vsx_string.h"
+#include "compilation_context.h"
 
 class named_values
 {
   std::map<vsx_string<>, llvm::AllocaInst* > values;
+
+  // fixed size arrays, the alloca is of type [N x double]
+  std::map<vsx_string<>, llvm::AllocaInst* > arrays;
+
+  // integer induction variables of the enclosing foreach loops,
+  // keyed by the array name (for *array) and by the index name
+  std::map<vsx_string<>, llvm::Value* > cursors;
+  std::map<vsx_string<>, llvm::Value* > indices;
+
+  // read-only values bound without an alloca, e.g. destructured results
+  std::map<vsx_string<>, llvm::Value* > ssa_values;
+
 public:
 
   void set(vsx_string<> s, llvm::AllocaInst* v)
@@ -24,15 +37,58 @@ public:
     values.erase(s);
   }
 
+  void set_array(vsx_string<> s, llvm::AllocaInst* v)
+  {
+    arrays[s] = v;
+  }
+
+  llvm::AllocaInst* get_array(vsx_string<> s)
+  {
+    return arrays[s];
+  }
+
+  void set_cursor(vsx_string<> s, llvm::Value* v)
+  {
+    cursors[s] = v;
+  }
+
+  llvm::Value* get_cursor(vsx_string<> s)
+  {
+    return cursors[s];
+  }
+
+  void set_index(vsx_string<> s, llvm::Value* v)
+  {
+    indices[s] = v;
+  }
+
+  llvm::Value* get_index(vsx_string<> s)
+  {
+    return indices[s];
+  }
+
+  void set_value(vsx_string<> s, llvm::Value* v)
+  {
+    ssa_values[s] = v;
+  }
+
+  llvm::Value* get_value(vsx_string<> s)
+  {
+    return ssa_values[s];
+  }
+
   void clear()
   {
     values.clear();
+    arrays.clear();
+    cursors.clear();
+    indices.clear();
+    ssa_values.clear();
   }
 
   static named_values* get_instance()
   {
-    static named_values mm;
-    return &mm;
+    return compilation_context::current()->get<named_values>(compilation_context::c_named_values);
   }
 };
 
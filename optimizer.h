@@ -0,0 +1,56 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "llvm_includes.h"
+
+class optimizer
+{
+public:
+
+  /// add_function_passes - Set up the per function pipeline for the given
+  /// optimization level. -O0 adds nothing so the IR stays as emitted.
+  static void add_function_passes
+  (
+    llvm::legacy::FunctionPassManager &FPM,
+    llvm::TargetMachine *TM,
+    unsigned level
+  )
+  {
+    if (!level)
+      return;
+
+    // Register info about how the target lays out data structures, and the
+    // target cost model used by the vectorizer and unroller.
+    FPM.add(new llvm::DataLayoutPass());
+    TM->addAnalysisPasses(FPM);
+
+    // Provide basic AliasAnalysis support for GVN.
+    FPM.add(llvm::createBasicAliasAnalysisPass());
+    // Promote allocas to registers.
+    FPM.add(llvm::createPromoteMemoryToRegisterPass());
+    // Do simple "peephole" optimizations and bit-twiddling optzns.
+    FPM.add(llvm::createInstructionCombiningPass());
+    // Reassociate expressions.
+    FPM.add(llvm::createReassociatePass());
+    // Eliminate Common SubExpressions.
+    FPM.add(llvm::createGVNPass());
+    // Simplify the control flow graph (deleting unreachable blocks, etc).
+    FPM.add(llvm::createCFGSimplificationPass());
+
+    if (level < 2)
+      return;
+
+    // Loop pipeline. Loops are emitted rotated already, LoopRotate only has
+    // to clean up what the scalar passes left behind.
+    FPM.add(llvm::createLoopRotatePass());
+    FPM.add(llvm::createLICMPass());
+    FPM.add(llvm::createIndVarSimplifyPass());
+    FPM.add(llvm::createLoopVectorizePass(level < 3, level >= 2));
+    FPM.add(llvm::createLoopUnrollPass());
+    FPM.add(llvm::createSLPVectorizerPass());
+    FPM.add(llvm::createInstructionCombiningPass());
+    FPM.add(llvm::createCFGSimplificationPass());
+  }
+};
+
+#endif
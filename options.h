@@ -0,0 +1,480 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+/// options - Command line options of the compiler.
+class options
+{
+  unsigned opt_level = 0;
+  bool eval = true;
+  uint64_t eval_steps = 1000000;
+  const char* input = 0;
+  std::vector<const char*> inputs;
+  bool tiering = true;
+  uint64_t tier_calls = 1000;
+  uint64_t tier_back_edges = 100000;
+  const char* cache_dir = 0;
+  uint64_t cache_size = 256;
+  const char* output = 0;
+  bool dump_ir = false;
+  bool debug_info = true;
+  bool huge_pages = false;
+  const char* mcpu = 0;
+  const char* mattr = 0;
+  bool fp_contract = false;
+  bool fast_math = false;
+  bool whole_program = false;
+  int jobs = -1; // -1 = one per core
+  const char* trace = 0;
+  bool mem_stats = false;
+  bool remarks = false;
+  const char* remarks_file = 0;
+  bool profile = false;
+  bool profile_loops = false;
+  const char* profile_generate = 0;
+  const char* profile_use = 0;
+  bool perf_map = false;
+  bool jitdump = false;
+
+public:
+
+  void usage(const char* argv0)
+  {
+    fprintf(stderr,
+      "usage: %s [options] [file...]\n"
+      "  -O0 .. -O3          optimization level (default -O0)\n"
+      "  -fno-eval           do not fold pure top-level expressions at compile time\n"
+      "  -eval-steps=N       step limit for compile time evaluation (default 1000000)\n"
+      "  -fno-tiering        compile every function on its first call instead of\n"
+      "                      interpreting it until it is hot\n"
+      "  -tier-calls=N       calls before a function is compiled (default 1000)\n"
+      "  -tier-loops=N       loop iterations before a function is compiled (default 100000)\n"
+      "  -jobs=N             background compile threads (default one per core), 0\n"
+      "                      compiles each function on the main thread when needed\n"
+      "  -cache-dir=DIR      cache compiled objects in DIR across runs\n"
+      "  -cache-size=MB      size limit of the object cache (default 256)\n"
+      "  -jit-huge-pages      put JIT code on huge pages, mapped read/write/execute\n"
+      "  -mcpu=NAME          generate code for CPU NAME instead of the host CPU\n"
+      "  -mattr=+a,-b,...    enable or disable target features instead of those\n"
+      "                      of the host\n"
+      "  -ffp-contract=fast  fuse floating point multiply and add into FMA\n"
+      "  -ffp-contract=off   keep them separate (default)\n"
+      "  -ffast-math         let floating point math be reordered, like the fastmath\n"
+      "                      attribute on every function\n"
+      "  -g, -g0             emit debug info (default) or none, which compiles faster\n"
+      "  -dump-ir            print the IR of every module before it is compiled\n"
+      "  -perf-map           list JIT functions in /tmp/perf-<pid>.map for perf\n"
+      "  -jitdump            write JIT code and line tables to jit-<pid>.dump for\n"
+      "                      perf inject --jit\n"
+      "  -profile            count calls and cycles per function in JIT code and print\n"
+      "                      a flat profile at exit (implies -fno-tiering)\n"
+      "  -profile-loops      -profile, and count loop iterations\n"
+      "  -profile-generate=FILE\n"
+      "                      count branches and loop trips in JIT code and write\n"
+      "                      them to FILE at exit (implies -fno-tiering)\n"
+      "  -profile-use=FILE   optimize with the branch and loop profile in FILE\n"
+      "  -trace=FILE         write compile phase timings to FILE as a Chrome trace\n"
+      "                      and print a summary per phase\n"
+      "  -remarks[=FILE]     report optimization remarks and IR size per function to\n"
+      "                      stderr or FILE (YAML if FILE ends in .yaml)\n"
+      "  -mem-stats          print allocations, RSS growth, AST, IR and code size per\n"
+      "                      phase and per top-level item\n"
+      "  -whole-program      with -o: internalize all but the top-level expressions,\n"
+      "                      use fastcc and drop unused functions (not for .so)\n"
+      "  -o FILE             compile ahead of time to an object file, or to a\n"
+      "                      shared library if FILE ends in .so\n"
+      "Several files are compiled and run in parallel, each on a thread of its own.\n",
+      argv0
+    );
+  }
+
+  bool parse(int argc, char** argv)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      const char* arg = argv[i];
+
+      if (arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3' && !arg[3])
+      {
+        opt_level = arg[2] - '0';
+        continue;
+      }
+
+      if (!strcmp(arg, "-fno-eval"))
+      {
+        eval = false;
+        continue;
+      }
+
+      if (!strncmp(arg, "-eval-steps=", 12))
+      {
+        eval_steps = strtoull(arg + 12, 0, 10);
+        continue;
+      }
+
+      if (!strcmp(arg, "-fno-tiering"))
+      {
+        tiering = false;
+        continue;
+      }
+
+      if (!strncmp(arg, "-tier-calls=", 12))
+      {
+        tier_calls = strtoull(arg + 12, 0, 10);
+        continue;
+      }
+
+      if (!strncmp(arg, "-tier-loops=", 12))
+      {
+        tier_back_edges = strtoull(arg + 12, 0, 10);
+        continue;
+      }
+
+      if (!strcmp(arg, "-jit-huge-pages"))
+      {
+        huge_pages = true;
+        continue;
+      }
+
+      if (!strncmp(arg, "-mcpu=", 6))
+      {
+        mcpu = arg + 6;
+        continue;
+      }
+
+      if (!strncmp(arg, "-mattr=", 7))
+      {
+        mattr = arg + 7;
+        continue;
+      }
+
+      if (!strcmp(arg, "-ffp-contract=fast") || !strcmp(arg, "-ffp-contract=off"))
+      {
+        fp_contract = !strcmp(arg + 14, "fast");
+        continue;
+      }
+
+      if (!strcmp(arg, "-whole-program"))
+      {
+        whole_program = true;
+        continue;
+      }
+
+      if (!strcmp(arg, "-ffast-math"))
+      {
+        fast_math = true;
+        continue;
+      }
+
+      if (!strcmp(arg, "-g") || !strcmp(arg, "-g0"))
+      {
+        debug_info = !arg[2];
+        continue;
+      }
+
+      if (!strcmp(arg, "-dump-ir"))
+      {
+        dump_ir = true;
+        continue;
+      }
+
+      if (!strcmp(arg, "-perf-map"))
+      {
+        perf_map = true;
+        continue;
+      }
+
+      if (!strcmp(arg, "-jitdump"))
+      {
+        jitdump = true;
+        continue;
+      }
+
+      if (!strcmp(arg, "-profile"))
+      {
+        profile = true;
+        continue;
+      }
+
+      if (!strcmp(arg, "-profile-loops"))
+      {
+        profile = profile_loops = true;
+        continue;
+      }
+
+      if (!strncmp(arg, "-profile-generate=", 18))
+      {
+        profile_generate = arg + 18;
+        continue;
+      }
+
+      if (!strncmp(arg, "-profile-use=", 13))
+      {
+        profile_use = arg + 13;
+        continue;
+      }
+
+      if (!strncmp(arg, "-trace=", 7))
+      {
+        trace = arg + 7;
+        continue;
+      }
+
+      if (!strcmp(arg, "-remarks"))
+      {
+        remarks = true;
+        continue;
+      }
+
+      if (!strncmp(arg, "-remarks=", 9))
+      {
+        remarks = true;
+        remarks_file = arg + 9;
+        continue;
+      }
+
+      if (!strcmp(arg, "-mem-stats"))
+      {
+        mem_stats = true;
+        continue;
+      }
+
+      if (!strcmp(arg, "-o") && i + 1 < argc)
+      {
+        output = argv[++i];
+        continue;
+      }
+
+      if (!strncmp(arg, "-jobs=", 6))
+      {
+        jobs = atoi(arg + 6);
+        continue;
+      }
+
+      if (!strncmp(arg, "-cache-dir=", 11))
+      {
+        cache_dir = arg + 11;
+        continue;
+      }
+
+      if (!strncmp(arg, "-cache-size=", 12))
+      {
+        cache_size = strtoull(arg + 12, 0, 10);
+        continue;
+      }
+
+      if (arg[0] != '-')
+      {
+        if (!input)
+          input = arg;
+        inputs.push_back(arg);
+        continue;
+      }
+
+      fprintf(stderr, "Unknown option: %s\n", arg);
+      usage(argv[0]);
+      return false;
+    }
+
+    if (output && inputs.size() > 1)
+    {
+      fprintf(stderr, "-o takes a single input file\n");
+      return false;
+    }
+
+    // A library's definitions are its interface, internalizing them would
+    // leave it empty.
+    size_t n = output ? strlen(output) : 0;
+    if (whole_program && n > 3 && !strcmp(output + n - 3, ".so"))
+    {
+      fprintf(stderr, "-whole-program cannot be used for a shared library (-o %s)\n", output);
+      return false;
+    }
+    return true;
+  }
+
+  unsigned get_opt_level()
+  {
+    return opt_level;
+  }
+
+  bool get_eval()
+  {
+    return eval;
+  }
+
+  uint64_t get_eval_steps()
+  {
+    return eval_steps;
+  }
+
+  /// get_tiering - Interpret cold functions. Off when profiling, which
+  /// measures compiled code.
+  bool get_tiering()
+  {
+    return tiering && !get_profile() && !get_profile_generate();
+  }
+
+  uint64_t get_tier_calls()
+  {
+    return tier_calls;
+  }
+
+  uint64_t get_tier_back_edges()
+  {
+    return tier_back_edges;
+  }
+
+  /// get_jobs - Number of background compile threads, 0 for none.
+  unsigned get_jobs()
+  {
+    if (jobs >= 0)
+      return jobs;
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores ? cores : 1;
+  }
+
+  /// get_cache_dir - Object cache directory, or 0 when caching is off.
+  const char* get_cache_dir()
+  {
+    return cache_dir;
+  }
+
+  uint64_t get_cache_size_bytes()
+  {
+    return cache_size << 20;
+  }
+
+  bool get_huge_pages()
+  {
+    return huge_pages;
+  }
+
+  /// get_mcpu - CPU to generate code for, 0 for the host CPU.
+  const char* get_mcpu()
+  {
+    return mcpu;
+  }
+
+  /// get_mattr - Comma separated target features, 0 for the host features.
+  const char* get_mattr()
+  {
+    return mattr;
+  }
+
+  bool get_fp_contract()
+  {
+    return fp_contract;
+  }
+
+  bool get_fast_math()
+  {
+    return fast_math;
+  }
+
+  /// get_debug_info - Emit DWARF for functions, arguments and locations.
+  bool get_debug_info()
+  {
+    return debug_info;
+  }
+
+  bool get_dump_ir()
+  {
+    return dump_ir;
+  }
+
+  bool get_perf_map()
+  {
+    return perf_map;
+  }
+
+  bool get_jitdump()
+  {
+    return jitdump;
+  }
+
+  /// get_profile - Instrument JIT code with call and cycle counters.
+  bool get_profile()
+  {
+    return profile && !output;
+  }
+
+  bool get_profile_loops()
+  {
+    return profile_loops && !output;
+  }
+
+  /// get_profile_generate - File to write the branch and loop profile of JIT
+  /// code to, or 0.
+  const char* get_profile_generate()
+  {
+    return output ? 0 : profile_generate;
+  }
+
+  /// get_profile_use - Profile to optimize with, or 0.
+  const char* get_profile_use()
+  {
+    return profile_use;
+  }
+
+  /// get_trace - Chrome trace output file, or 0 when tracing is off.
+  const char* get_trace()
+  {
+    return trace;
+  }
+
+  bool get_remarks()
+  {
+    return remarks;
+  }
+
+  /// get_remarks_file - Where to write the remarks, 0 for stderr.
+  const char* get_remarks_file()
+  {
+    return remarks_file;
+  }
+
+  bool get_mem_stats()
+  {
+    return mem_stats;
+  }
+
+  /// get_whole_program - Treat the ahead of time compiled module as the
+  /// whole program. The JIT keeps every definition callable.
+  bool get_whole_program()
+  {
+    return whole_program && output;
+  }
+
+  /// get_output - Ahead of time output file, or 0 to run in the JIT.
+  const char* get_output()
+  {
+    return output;
+  }
+
+  /// get_input - Source file to run, or 0 for the built in program.
+  const char* get_input()
+  {
+    return input;
+  }
+
+  /// get_inputs - All source files, run in parallel if there are several.
+  const std::vector<const char*> &get_inputs()
+  {
+    return inputs;
+  }
+
+  static options* get_instance()
+  {
+    static options o;
+    return &o;
+  }
+};
+
+#endif
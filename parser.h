@@ -5,6 +5,8 @@
 #include "binop_precedence.h"
 #include "source_location.h"
 #include "source.h"
+#include "compilation_context.h"
+#include "trace.h"
 
 class parser
 {
@@ -19,6 +21,7 @@ class parser
   double NumVal;             // Filled in if tok_number
   SourceLocation CurLoc;
   SourceLocation LexLoc = { 1, 0 };
+  int LastChar = ' ';
 
   char peek(size_t distance)
   {
@@ -81,8 +84,6 @@ public:
   /// gettok - Return the next token from standard input.
   int get_token()
   {
-    static int LastChar = ' ';
-
     // Skip any whitespace.
     while (isspace(LastChar))
       LastChar = advance();
@@ -90,9 +91,9 @@ public:
     CurLoc = LexLoc;
 
     if (isalpha(LastChar))
-    { // identifier: [a-zA-Z][a-zA-Z0-9]*
+    { // identifier: [a-zA-Z][a-zA-Z0-9_]*
       IdentifierStr = LastChar;
-      while (isalnum((LastChar = advance())))
+      while (isalnum((LastChar = advance())) || LastChar == '_')
         IdentifierStr += LastChar;
 
       if (IdentifierStr == "extern")
@@ -113,6 +114,14 @@ public:
         return tok_unary;
       if (IdentifierStr == "var")
         return tok_var;
+      if (IdentifierStr == "foreach")
+        return tok_foreach;
+      if (IdentifierStr == "class")
+        return tok_class;
+      if (IdentifierStr == "sizeof")
+        return tok_sizeof;
+      if (IdentifierStr == "fastmath")
+        return tok_fastmath;
 
       // Investigate if function
       if (' ' == LastChar && '(' == peek(0))
@@ -168,14 +177,18 @@ public:
 
   int get_next_token()
   {
+    if (!trace::get_instance()->is_enabled())
+      return current_token = get_token();
+
+    uint64_t start = trace::get_instance()->now();
     current_token = get_token();
+    trace::get_instance()->add_lex(trace::get_instance()->now() - start);
     return current_token;
   }
 
   static parser* get()
   {
-    static parser pp;
-    return &pp;
+    return compilation_context::current()->get<parser>(compilation_context::c_parser);
   }
 };
 
@@ -0,0 +1,305 @@
+#ifndef PGO_H
+#define PGO_H
+
+#include <cstdio>
+#include <cinttypes>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm_includes.h"
+#include "builder_manager.h"
+#include "compilation_context.h"
+#include "options.h"
+#include "jit/profiler.h"
+
+/// pgo - Profile guided optimization.
+///
+/// With -profile-generate=FILE every if counts how often it takes either
+/// branch and every for loop how often it is reached, entered and iterates.
+/// The counters are host records reached by symbol, like the profiler's, and
+/// are written to FILE at exit.
+///
+/// With -profile-use=FILE a later compile reads them back: ifs get branch
+/// weights, for loops get weights on the guard and on the latch, from which
+/// LLVM derives the trip count for block placement and the loop passes.
+/// foreach needs no counters, its trip count is the array size.
+///
+/// Profiles are matched to functions by a hash of the function body, so
+/// renaming or moving a function keeps its profile while editing it drops
+/// it. Within a function the sites are numbered in code generation order.
+///
+/// The counters and the profile are shared by all compilation contexts, so
+/// the same function body compiled by two programs counts into the same
+/// records. The function being generated is per context.
+class pgo
+{
+public:
+
+  /// site fields, by kind
+  enum
+  {
+    if_then = 0,
+    if_else = 1,
+
+    loop_reached = 0,
+    loop_entered = 1,
+    loop_iterations = 2,
+
+    site_fields = 3
+  };
+
+private:
+
+  struct site_record
+  {
+    uint64_t counts[site_fields];
+  };
+
+  struct function_profile
+  {
+    std::string name;
+    std::vector<site_record *> sites;
+  };
+
+  // Generated counters, deque so record addresses stay stable.
+  std::mutex mutex;
+  std::deque<site_record> records;
+  std::map<uint64_t, function_profile> generated;
+
+  // Profile read back, by body hash. Only written before compiling.
+  std::map<uint64_t, std::vector<site_record> > loaded;
+
+public:
+
+  /// function_state - The function being generated in a context.
+  struct function_state
+  {
+    uint64_t hash = 0;
+    bool in_function = false;
+    unsigned next_site = 0;
+  };
+
+private:
+
+  static function_state &current()
+  {
+    return *compilation_context::current()->get<function_state>(compilation_context::c_pgo);
+  }
+
+  static std::string site_symbol(uint64_t hash, unsigned site)
+  {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "__kaleidoscope_pgo.%016" PRIx64 ".%u", hash, site);
+    return buf;
+  }
+
+  site_record *get_site_record(unsigned site)
+  {
+    uint64_t hash = current().hash;
+    std::lock_guard<std::mutex> Lock(mutex);
+    function_profile &F = generated[hash];
+    while (F.sites.size() <= site)
+    {
+      site_record r = { { 0, 0, 0 } };
+      records.push_back(r);
+      F.sites.push_back(&records.back());
+      jit_engine::get_instance()->add_host_symbol(site_symbol(hash, F.sites.size() - 1),
+                                                  &records.back());
+    }
+    return F.sites[site];
+  }
+
+  /// scale - Fit a count into a 32 bit branch weight. Weights are never 0,
+  /// an edge that was not taken in the profile is unlikely, not impossible.
+  static uint32_t scale(uint64_t count, uint64_t divisor)
+  {
+    return (uint32_t)(count / divisor + 1);
+  }
+
+public:
+
+  bool is_generating()
+  {
+    return options::get_instance()->get_profile_generate() != 0;
+  }
+
+  bool is_using()
+  {
+    return options::get_instance()->get_profile_use() != 0;
+  }
+
+  /// hash_body - FNV-1a of a function dump, with the source locations left
+  /// out.
+  static uint64_t hash_body(const char *dump)
+  {
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *p = dump; *p; p++)
+    {
+      // ast_expr::dump writes ":line:col\n" after every node.
+      if (*p == ':' && p[1] >= '0' && p[1] <= '9')
+      {
+        const char *q = p + 1;
+        while (*q >= '0' && *q <= '9')
+          q++;
+        if (*q == ':')
+        {
+          q++;
+          while (*q >= '0' && *q <= '9')
+            q++;
+          if (*q == '\n')
+          {
+            p = q;
+            continue;
+          }
+        }
+      }
+      h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+    return h;
+  }
+
+  /// begin_function - Start numbering the sites of a function body.
+  void begin_function(const std::string &name, uint64_t hash)
+  {
+    function_state &F = current();
+    F.hash = hash;
+    F.in_function = true;
+    F.next_site = 0;
+    if (is_generating())
+    {
+      std::lock_guard<std::mutex> Lock(mutex);
+      generated[hash].name = name;
+    }
+  }
+
+  void end_function()
+  {
+    current().in_function = false;
+  }
+
+  /// add_site - Number the next branch or loop, -1 if there is no profiling
+  /// to do for it.
+  int add_site()
+  {
+    function_state &F = current();
+    if (!F.in_function || (!is_generating() && !is_using()))
+      return -1;
+    return F.next_site++;
+  }
+
+  /// count - Emit site.field++ at the insert point.
+  void count(int site, unsigned field)
+  {
+    if (site < 0 || !is_generating())
+      return;
+    get_site_record(site);
+    profiler::add(profiler::get_record(site_symbol(current().hash, site), site_fields), field,
+                  llvm::ConstantInt::get(profiler::get_int64(), 1), "pgo.count");
+  }
+
+  /// begin_loop - Set up an iteration count for site, kept in a register and
+  /// added by end_loop. 0 if not generating.
+  llvm::AllocaInst *begin_loop(int site)
+  {
+    if (site < 0 || !is_generating())
+      return 0;
+    return profiler::get_instance()->begin_loop();
+  }
+
+  void end_loop(int site, llvm::AllocaInst *Iterations)
+  {
+    if (!Iterations)
+      return;
+    get_site_record(site);
+    profiler::add(profiler::get_record(site_symbol(current().hash, site), site_fields), loop_iterations,
+                  builder_manager::get_instance()->get_ir()->CreateLoad(Iterations), "pgo.iterations");
+  }
+
+  /// get_counts - The profiled counts of site, or 0 if the profile has none.
+  const uint64_t *get_counts(int site)
+  {
+    if (site < 0 || !is_using())
+      return 0;
+    std::map<uint64_t, std::vector<site_record> >::iterator it = loaded.find(current().hash);
+    if (it == loaded.end() || (size_t)site >= it->second.size())
+      return 0;
+    return it->second[site].counts;
+  }
+
+  /// set_weights - Attach branch weights for the true and false edge of
+  /// Branch.
+  static void set_weights(llvm::BranchInst *Branch, uint64_t taken, uint64_t not_taken)
+  {
+    uint64_t max = taken > not_taken ? taken : not_taken;
+    uint64_t divisor = max / UINT32_MAX + 1;
+    llvm::MDBuilder MDB(compilation_context::current()->get_llvm_context());
+    Branch->setMetadata(llvm::LLVMContext::MD_prof,
+                        MDB.createBranchWeights(scale(taken, divisor), scale(not_taken, divisor)));
+  }
+
+  /// write - Write the generated counters. One line per function,
+  ///   function <hash> <sites> <name>
+  /// followed by one line of counts per site.
+  bool write(const char *path)
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    FILE *f = fopen(path, "w");
+    if (!f)
+      return false;
+
+    fprintf(f, "# kaleidoscope profile\n");
+    for (std::map<uint64_t, function_profile>::iterator it = generated.begin(); it != generated.end(); ++it)
+    {
+      const function_profile &F = it->second;
+      fprintf(f, "function %016" PRIx64 " %u %s\n", it->first, (unsigned)F.sites.size(), F.name.c_str());
+      for (size_t i = 0; i < F.sites.size(); i++)
+        fprintf(f, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                F.sites[i]->counts[0], F.sites[i]->counts[1], F.sites[i]->counts[2]);
+    }
+    return !fclose(f);
+  }
+
+  /// load - Read a profile written by write.
+  bool load(const char *path)
+  {
+    FILE *f = fopen(path, "r");
+    if (!f)
+      return false;
+
+    char line[512];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f))
+    {
+      if (line[0] == '#')
+        continue;
+
+      uint64_t hash;
+      unsigned sites;
+      if (sscanf(line, "function %" SCNx64 " %u", &hash, &sites) != 2)
+      {
+        ok = false;
+        break;
+      }
+
+      std::vector<site_record> &F = loaded[hash];
+      F.resize(sites);
+      for (unsigned i = 0; i < sites && ok; i++)
+        ok = fgets(line, sizeof(line), f) &&
+             sscanf(line, "%" SCNu64 " %" SCNu64 " %" SCNu64,
+                    &F[i].counts[0], &F[i].counts[1], &F[i].counts[2]) == 3;
+    }
+    fclose(f);
+    return ok;
+  }
+
+  static pgo* get_instance()
+  {
+    static pgo p;
+    return &p;
+  }
+};
+
+#endif
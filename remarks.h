@@ -0,0 +1,307 @@
+#ifndef REMARKS_H
+#define REMARKS_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm_includes.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// remarks - Optimization remarks and IR size per function (-remarks).
+///
+/// A diagnostic handler on every LLVMContext that optimizes code (the main
+/// one and those of the compile pipeline workers) collects the passed,
+/// missed and analysis remarks of the function passes: what was vectorized,
+/// unrolled or not, and why. They are reported per function at exit with
+/// their source line and column, which come from the debug info (-g), next to
+/// the IR instruction and basic block counts before and after optimization.
+/// Where a module pass pipeline runs after the function passes (the ahead of
+/// time compiler) the counts after optimization are taken after it, and
+/// functions it removed are reported as removed.
+///
+/// -remarks prints them to stderr, -remarks=FILE writes them to FILE, as YAML
+/// if FILE ends in .yaml or .yml.
+///
+/// Functions are reported by symbol, which is unique across compilation
+/// contexts, and each remark keeps the file its debug location points to,
+/// so several programs compiled at once stay apart. Every context's
+/// LLVMContext needs the handler, see install.
+class remarks
+{
+  struct remark
+  {
+    const char *kind;
+    std::string pass;
+    std::string file;
+    unsigned line;
+    unsigned col;
+    std::string message;
+  };
+
+  struct function_report
+  {
+    unsigned insts_before = 0;
+    unsigned blocks_before = 0;
+    unsigned insts_after = 0;
+    unsigned blocks_after = 0;
+    bool optimized = false;
+    bool removed = false;
+    std::vector<remark> remarks;
+  };
+
+  bool enabled = false;
+  std::string source;
+
+  std::mutex mutex;
+  std::vector<std::string> order;
+  std::map<std::string, function_report> functions;
+
+  function_report &get_function(const std::string &name)
+  {
+    std::map<std::string, function_report>::iterator it = functions.find(name);
+    if (it != functions.end())
+      return it->second;
+    order.push_back(name);
+    return functions[name];
+  }
+
+  static void count(llvm::Function &F, unsigned &insts, unsigned &blocks)
+  {
+    insts = blocks = 0;
+    for (llvm::Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    {
+      blocks++;
+      insts += BB->size();
+    }
+  }
+
+  /// handle - The diagnostic handler. Other diagnostics are printed the way
+  /// LLVM does without a handler.
+  static void handle(const llvm::DiagnosticInfo &DI, void *Context)
+  {
+    const char *kind = 0;
+    switch (DI.getKind())
+    {
+      case llvm::DK_OptimizationRemark:         kind = "Passed"; break;
+      case llvm::DK_OptimizationRemarkMissed:   kind = "Missed"; break;
+      case llvm::DK_OptimizationRemarkAnalysis: kind = "Analysis"; break;
+      default: break;
+    }
+
+    if (!kind)
+    {
+      llvm::DiagnosticPrinterRawOStream DP(llvm::errs());
+      switch (DI.getSeverity())
+      {
+        case llvm::DS_Error:   llvm::errs() << "error: "; break;
+        case llvm::DS_Warning: llvm::errs() << "warning: "; break;
+        case llvm::DS_Remark:  llvm::errs() << "remark: "; break;
+        case llvm::DS_Note:    llvm::errs() << "note: "; break;
+      }
+      DI.print(DP);
+      llvm::errs() << "\n";
+      if (DI.getSeverity() == llvm::DS_Error)
+        exit(1);
+      return;
+    }
+
+    const llvm::DiagnosticInfoOptimizationBase &R =
+        static_cast<const llvm::DiagnosticInfoOptimizationBase &>(DI);
+
+    remark r = { kind, R.getPassName(), "", 0, 0, R.getMsg().str() };
+    if (R.isLocationAvailable())
+    {
+      llvm::StringRef File;
+      R.getLocation(&File, &r.line, &r.col);
+      r.file = File;
+    }
+
+    remarks *self = static_cast<remarks *>(Context);
+    std::lock_guard<std::mutex> Lock(self->mutex);
+    self->get_function(R.getFunction().getName()).remarks.push_back(r);
+  }
+
+  const std::string &get_file(const remark &r)
+  {
+    return r.file.empty() ? source : r.file;
+  }
+
+  static std::string yaml_quote(const std::string &s)
+  {
+    std::string out = "'";
+    for (size_t i = 0; i < s.size(); i++)
+    {
+      if (s[i] == '\'')
+        out += '\'';
+      if (s[i] != '\n')
+        out += s[i];
+    }
+    return out + "'";
+  }
+
+  void write_text(FILE *f)
+  {
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const function_report &F = functions[order[i]];
+      if (F.removed)
+        fprintf(f, "%s: %u instructions in %u blocks, removed by optimization\n",
+                order[i].c_str(), F.insts_before, F.blocks_before);
+      else if (F.optimized)
+        fprintf(f, "%s: %u instructions in %u blocks, %u instructions in %u blocks after optimization\n",
+                order[i].c_str(), F.insts_before, F.blocks_before, F.insts_after, F.blocks_after);
+      else
+        fprintf(f, "%s:\n", order[i].c_str());
+
+      for (size_t j = 0; j < F.remarks.size(); j++)
+      {
+        const remark &r = F.remarks[j];
+        fprintf(f, "  %s:%u:%u: %-8s %s: %s\n", get_file(r).c_str(), r.line, r.col,
+                r.kind, r.pass.c_str(), r.message.c_str());
+      }
+    }
+  }
+
+  void write_yaml(FILE *f)
+  {
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const function_report &F = functions[order[i]];
+      if (F.optimized)
+        fprintf(f, "--- !IRSize\nFunction: %s\nInstructionsBefore: %u\nBlocksBefore: %u\n"
+                   "InstructionsAfter: %u\nBlocksAfter: %u\n%s...\n",
+                yaml_quote(order[i]).c_str(), F.insts_before, F.blocks_before,
+                F.insts_after, F.blocks_after, F.removed ? "Removed: true\n" : "");
+
+      for (size_t j = 0; j < F.remarks.size(); j++)
+      {
+        const remark &r = F.remarks[j];
+        fprintf(f, "--- !%s\nPass: %s\nFunction: %s\n", r.kind, yaml_quote(r.pass).c_str(),
+                yaml_quote(order[i]).c_str());
+        if (r.line)
+          fprintf(f, "DebugLoc: { File: %s, Line: %u, Column: %u }\n",
+                  yaml_quote(get_file(r)).c_str(), r.line, r.col);
+        fprintf(f, "Message: %s\n...\n", yaml_quote(r.message).c_str());
+      }
+    }
+  }
+
+public:
+
+  /// init - Turn remarks on, for the program read from source.
+  void init(bool on, const char *source_name)
+  {
+    enabled = on;
+    source = source_name;
+  }
+
+  bool is_enabled()
+  {
+    return enabled;
+  }
+
+  /// install - Collect the remarks of passes run in Context.
+  void install(llvm::LLVMContext &Context)
+  {
+    if (enabled)
+      Context.setDiagnosticHandler(&remarks::handle, this);
+  }
+
+  /// begin_function, end_function - Count the IR of F before and after the
+  /// function passes.
+  void begin_function(llvm::Function &F)
+  {
+    unsigned insts, blocks;
+    count(F, insts, blocks);
+
+    std::lock_guard<std::mutex> Lock(mutex);
+    function_report &r = get_function(F.getName());
+    r.insts_before = insts;
+    r.blocks_before = blocks;
+  }
+
+  void end_function(llvm::Function &F)
+  {
+    unsigned insts, blocks;
+    count(F, insts, blocks);
+
+    std::lock_guard<std::mutex> Lock(mutex);
+    function_report &r = get_function(F.getName());
+    r.insts_after = insts;
+    r.blocks_after = blocks;
+    r.optimized = true;
+  }
+
+  /// begin_module, end_module - Count the IR of the functions M defines once
+  /// more after a module pass pipeline ran on it. begin_module returns the
+  /// functions defined before, those missing afterwards were inlined
+  /// everywhere or dead.
+  static std::vector<std::string> begin_module(llvm::Module &M)
+  {
+    std::vector<std::string> defined;
+    for (llvm::Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+      if (!F->isDeclaration())
+        defined.push_back(F->getName());
+    return defined;
+  }
+
+  void end_module(llvm::Module &M, const std::vector<std::string> &defined)
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    for (size_t i = 0; i < defined.size(); i++)
+    {
+      // Only the functions the function passes were counted for.
+      std::map<std::string, function_report>::iterator it = functions.find(defined[i]);
+      if (it == functions.end() || !it->second.optimized)
+        continue;
+
+      function_report &r = it->second;
+      llvm::Function *F = M.getFunction(defined[i]);
+      if (!F || F->isDeclaration())
+      {
+        r.insts_after = r.blocks_after = 0;
+        r.removed = true;
+      }
+      else
+        count(*F, r.insts_after, r.blocks_after);
+    }
+  }
+
+  /// write - Report to path, or to stderr if path is 0.
+  bool write(const char *path)
+  {
+    std::lock_guard<std::mutex> Lock(mutex);
+    if (!path)
+    {
+      write_text(stderr);
+      return true;
+    }
+
+    FILE *f = fopen(path, "w");
+    if (!f)
+      return false;
+
+    size_t n = strlen(path);
+    bool yaml = (n > 5 && !strcmp(path + n - 5, ".yaml")) || (n > 4 && !strcmp(path + n - 4, ".yml"));
+    if (yaml)
+      write_yaml(f);
+    else
+      write_text(f);
+    return !fclose(f);
+  }
+
+  static remarks* get_instance()
+  {
+    static remarks r;
+    return &r;
+  }
+};
+
+#endif
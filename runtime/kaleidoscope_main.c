@@ -0,0 +1,13 @@
+/* Entry point for ahead-of-time compiled Kaleidoscope programs.
+ *
+ * The compiler emits kaleidoscope_main, which runs the top-level
+ * expressions of the program in source order. Programs that embed the code
+ * (for example from a shared library) provide their own main instead.
+ */
+
+double kaleidoscope_main(void);
+
+int main(void) {
+  kaleidoscope_main();
+  return 0;
+}
@@ -1,6 +1,10 @@
 #ifndef SOURCE_H
 #define SOURCE_H
 
+#include <string>
+
+#include "compilation_context.h"
+
 class source
 {
 
@@ -15,8 +19,35 @@ class source
       "fib(40)"
     ;
 
+  std::string name = "fib.ks";
+
 public:
 
+  /// load - Replace the built in program with the contents of a file.
+  bool load(const char* path)
+  {
+    FILE* f = fopen(path, "rb");
+    if (!f)
+      return false;
+
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      text.append(buf, n);
+    fclose(f);
+
+    program = vsx_string<>(text.c_str());
+    name = path;
+    return true;
+  }
+
+  /// get_name - The file the program was read from, for debug info.
+  const std::string &get_name()
+  {
+    return name;
+  }
+
   vsx_string<>& get()
   {
     return program;
@@ -24,8 +55,7 @@ public:
 
   static source* get_instance()
   {
-    static source s;
-    return &s;
+    return compilation_context::current()->get<source>(compilation_context::c_source);
   }
 };
 
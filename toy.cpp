@@ -1,18 +1,23 @@
 #include "llvm_includes.h"
 #include "module_manager.h"
 #include "builder_manager.h"
+#include "options.h"
+#include "optimizer.h"
+#include "jit/jit_engine.h"
+#include "aot/aot_compiler.h"
 
 #include <cctype>
 #include <cstdio>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <new>
 #include <string>
+#include <thread>
 #include <vector>
 #include <vsx_string.h>
 
-static llvm::ExecutionEngine *TheExecutionEngine;
 //static std::map<vsx_string<>, llvm::AllocaInst *> NamedValues;
-static llvm::legacy::FunctionPassManager *TheFPM;
 
 #include "lex.h"
 #include "parser.h"
@@ -23,6 +28,7 @@ static llvm::legacy::FunctionPassManager *TheFPM;
 #include "ast/ast_parse.h"
 #include "codegen.h"
 #include "dispatch.h"
+#include "remarks.h"
 
 //===----------------------------------------------------------------------===//
 // "Library" functions that can be "extern'd" from user code.
@@ -40,89 +46,166 @@ extern "C" double printd(double X) {
   return 0;
 }
 
+//===----------------------------------------------------------------------===//
+// Allocation counting for -mem-stats.
+//===----------------------------------------------------------------------===//
+
+void *operator new(size_t Size) {
+  memory_stats::count_allocation(Size);
+  if (void *P = malloc(Size ? Size : 1))
+    return P;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t Size) {
+  return operator new(Size);
+}
+
+void operator delete(void *P) noexcept {
+  free(P);
+}
+
+void operator delete[](void *P) noexcept {
+  free(P);
+}
+
 //===----------------------------------------------------------------------===//
 // Main driver code.
 //===----------------------------------------------------------------------===//
 
-int main() {
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::InitializeNativeTargetAsmParser();
-  llvm::LLVMContext &Context = llvm::getGlobalContext();
+/// write_reports - Report the optimization remarks (-remarks), memory use
+/// (-mem-stats) and compile phase timings (-trace) at exit.
+static void write_reports() {
+  const char *Remarks = options::get_instance()->get_remarks_file();
+  if (options::get_instance()->get_remarks() && !remarks::get_instance()->write(Remarks))
+    fprintf(stderr, "Could not write remarks to %s\n", Remarks);
+
+  if (options::get_instance()->get_mem_stats())
+    memory_stats::get_instance()->print_summary();
+
+  const char *Path = options::get_instance()->get_trace();
+  if (!Path)
+    return;
+
+  if (!trace::get_instance()->write(Path))
+    fprintf(stderr, "Could not write trace to %s\n", Path);
+  trace::get_instance()->print_summary();
+}
 
-  // Initialize IR builder
-  builder_manager::get_instance()->set_ir( new llvm::IRBuilder<>( llvm::getGlobalContext() ) );
+/// RunProgram - Compile and run one of several input files in Context, on
+/// the calling thread.
+static void RunProgram(compilation_context *Context, const char *Path) {
+  compilation_context::scope Scope(Context);
+  remarks::get_instance()->install(Context->get_llvm_context());
+
+  if (!source::get_instance()->load(Path)) {
+    fprintf(stderr, "Could not read %s\n", Path);
+    return;
+  }
 
   // Prime the first token.
   parser::get()->get_next_token();
+  MainLoop();
+}
 
-  // Make the module, which holds all the code.
-  std::unique_ptr< llvm::Module > Owner = llvm::make_unique< llvm::Module>("my cool jit", Context);
+int main(int argc, char** argv) {
+  if (!options::get_instance()->parse(argc, argv))
+    return 1;
 
-  module_manager::get_instance()->set( Owner.get() );
+  trace::get_instance()->init(options::get_instance()->get_trace() != 0);
+  memory_stats::get_instance()->init(options::get_instance()->get_mem_stats());
 
-  // Add the current debug info version into the module.
-  module_manager::get_instance()->get()->addModuleFlag( llvm::Module::Warning, "Debug Info Version",
-                           llvm::DEBUG_METADATA_VERSION);
+  const char *Input = options::get_instance()->get_input();
+  remarks::get_instance()->init(options::get_instance()->get_remarks(), Input ? Input : "<builtin>");
+  remarks::get_instance()->install(compilation_context::current()->get_llvm_context());
 
-  // Darwin only supports dwarf2.
-  if (llvm::Triple( llvm::sys::getProcessTriple()).isOSDarwin())
-    module_manager::get_instance()->get()->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 2);
+  const std::vector<const char *> &Inputs = options::get_instance()->get_inputs();
+  if (Inputs.size() == 1 && !source::get_instance()->load(Inputs[0]))
+  {
+    fprintf(stderr, "Could not read %s\n", options::get_instance()->get_input());
+    return 1;
+  }
 
-  // Construct the DIBuilder, we do this here because we need the module.
-  builder_manager::get_instance()->set_di( new llvm::DIBuilder(*module_manager::get_instance()->get()) );
+  if (options::get_instance()->get_profile_use() &&
+      !pgo::get_instance()->load(options::get_instance()->get_profile_use()))
+  {
+    fprintf(stderr, "Could not read profile %s\n", options::get_instance()->get_profile_use());
+    return 1;
+  }
 
-  // Create the compile unit for the module.
-  // Currently down as "fib.ks" as a filename since we're redirecting stdin
-  // but we'd like actual source locations.
-  debug_manager::get_instance()->init();
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
 
-  // Create the JIT.  This takes ownership of the module.
+  // Prime the first token.
+  if (Inputs.size() <= 1)
+    parser::get()->get_next_token();
+
+  if (const char *Output = options::get_instance()->get_output())
+  {
+    std::string ErrStr;
+    if (!aot_compiler::get_instance()->init(ErrStr)) {
+      fprintf(stderr, "Could not create target machine: %s\n", ErrStr.c_str());
+      exit(1);
+    }
+
+    MainLoop();
+
+    bool Emitted = aot_compiler::get_instance()->emit(Output);
+    write_reports();
+    return Emitted ? 0 : 1;
+  }
+
+  // Create the JIT. Modules, debug info and the function pass pipeline are
+  // set up per definition, see jit_engine::begin_module.
   std::string ErrStr;
-  TheExecutionEngine =
-      llvm::EngineBuilder(std::move(Owner))
-          .setErrorStr(&ErrStr)
-          //.setMCJITMemoryManager(llvm::make_unique<SectionMemoryManager>())
-          .create();
-  if (!TheExecutionEngine) {
+  if (!jit_engine::get_instance()->init(ErrStr)) {
     fprintf(stderr, "Could not create ExecutionEngine: %s\n", ErrStr.c_str());
     exit(1);
   }
 
-  llvm::legacy::FunctionPassManager OurFPM( module_manager::get_instance()->get() );
-
-  // Set up the optimizer pipeline.  Start with registering info about how the
-  // target lays out data structures.
-  module_manager::get_instance()->get()->setDataLayout(TheExecutionEngine->getDataLayout());
-  #if 0
-  // Provide basic AliasAnalysis support for GVN.
-  OurFPM.add(createBasicAliasAnalysisPass());
-  // Promote allocas to registers.
-  OurFPM.add(createPromoteMemoryToRegisterPass());
-  // Do simple "peephole" optimizations and bit-twiddling optzns.
-  OurFPM.add(createInstructionCombiningPass());
-  // Reassociate expressions.
-  OurFPM.add(createReassociatePass());
-  // Eliminate Common SubExpressions.
-  OurFPM.add(createGVNPass());
-  // Simplify the control flow graph (deleting unreachable blocks, etc).
-  OurFPM.add(createCFGSimplificationPass());
-  #endif
-  OurFPM.doInitialization();
-
-  // Set the global so the code gen can use this.
-  TheFPM = &OurFPM;
-
-  // Run the main "interpreter loop" now.
-  MainLoop();
-
-  TheFPM = 0;
-
-  // Finalize the debug info.
-  builder_manager::get_instance()->get_di()->finalize();
-
-  // Print out all of the generated code.
-  module_manager::get_instance()->get()->dump();
+  jit_engine::get_instance()->add_host_symbol("putchard", (void *)&putchard);
+  jit_engine::get_instance()->add_host_symbol("printd", (void *)&printd);
+
+  // Run the main "interpreter loop" now, or one per input file, each in a
+  // compilation context on a thread of its own. The contexts outlive their
+  // threads, the JIT may compile their code until it shuts down.
+  std::deque<compilation_context> Contexts;
+  if (Inputs.size() > 1)
+  {
+    std::vector<std::thread> Threads;
+    for (size_t i = 0; i < Inputs.size(); i++)
+    {
+      Contexts.emplace_back();
+      Threads.push_back(std::thread(RunProgram, &Contexts.back(), Inputs[i]));
+    }
+    for (size_t i = 0; i < Threads.size(); i++)
+      Threads[i].join();
+  }
+  else
+    MainLoop();
+
+  // Wait for background compilation to finish.
+  tiering::get_instance()->shutdown();
+  compile_pipeline::get_instance()->shutdown();
+
+  if (options::get_instance()->get_jobs())
+    compile_pipeline::get_instance()->print_stats();
+  if (options::get_instance()->get_cache_dir())
+    object_cache::get_instance()->print_stats();
+
+  fprintf(stderr, "JIT: %llu modules compiled, %llu never called\n",
+          (unsigned long long)jit_engine::get_instance()->get_modules_emitted(),
+          (unsigned long long)jit_engine::get_instance()->get_modules_pending());
+  jit_engine::get_instance()->get_memory_manager()->print_stats();
+
+  if (options::get_instance()->get_profile())
+    profiler::get_instance()->dump();
+
+  const char *Profile = options::get_instance()->get_profile_generate();
+  if (Profile && !pgo::get_instance()->write(Profile))
+    fprintf(stderr, "Could not write profile to %s\n", Profile);
+  write_reports();
 
   return 0;
 }
@@ -0,0 +1,291 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "memory_stats.h"
+
+/// trace - Compile time per phase (lex, parse, codegen, verify, optimize,
+/// emit, link, run), recorded per top-level item by trace_scope when
+/// -trace=FILE is given.
+///
+/// The events are written as a Chrome trace (chrome://tracing, Perfetto), one
+/// track per thread, and summarized per phase with the slowest item of each.
+/// Lexing is interleaved with parsing, it is summed up per item and shown as
+/// one event at the start of the item's parse.
+///
+/// Phases nest (lex in parse, verify and optimize in codegen, emit and link
+/// in jit), so the summary reports self time: each event without the events
+/// nested in it on the same thread, and the phases add up to the time
+/// traced.
+class trace
+{
+  struct event
+  {
+    const char *phase;
+    std::string item;
+    uint64_t start; // ns since the trace started
+    uint64_t duration;
+    unsigned tid;
+  };
+
+  bool enabled = false;
+  std::chrono::steady_clock::time_point epoch;
+
+  std::mutex mutex;
+  std::vector<event> events;
+  std::atomic<unsigned> next_tid;
+
+  static std::string &current_item()
+  {
+    static thread_local std::string item;
+    return item;
+  }
+
+  static uint64_t &lex_time()
+  {
+    static thread_local uint64_t ns = 0;
+    return ns;
+  }
+
+  unsigned get_tid()
+  {
+    static thread_local unsigned tid = next_tid++;
+    return tid;
+  }
+
+  static std::string escape(const std::string &s)
+  {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+      if (s[i] == '"' || s[i] == '\\')
+        out += '\\';
+      if ((unsigned char)s[i] >= 0x20)
+        out += s[i];
+    }
+    return out;
+  }
+
+public:
+
+  trace()
+    : next_tid(1)
+  {
+  }
+
+  void init(bool on)
+  {
+    enabled = on;
+    epoch = std::chrono::steady_clock::now();
+  }
+
+  bool is_enabled()
+  {
+    return enabled;
+  }
+
+  uint64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - epoch).count();
+  }
+
+  /// set_item - Name of the top-level item the calling thread works on,
+  /// attached to the events that follow.
+  void set_item(const std::string &item)
+  {
+    current_item() = item;
+  }
+
+  const std::string &get_item()
+  {
+    return current_item();
+  }
+
+  void record(const char *phase, uint64_t start, uint64_t end)
+  {
+    event e = { phase, current_item(), start, end - start, get_tid() };
+    std::lock_guard<std::mutex> Lock(mutex);
+    events.push_back(e);
+  }
+
+  /// add_lex - Account time spent in the lexer.
+  void add_lex(uint64_t ns)
+  {
+    lex_time() += ns;
+  }
+
+  /// record_lex - Record the lexing time summed up since the last call as
+  /// one event starting at start.
+  void record_lex(uint64_t start)
+  {
+    if (lex_time())
+      record("lex", start, start + lex_time());
+    lex_time() = 0;
+  }
+
+  /// write - Write the events as Chrome trace JSON.
+  bool write(const char *path)
+  {
+    FILE *f = fopen(path, "w");
+    if (!f)
+      return false;
+
+    std::lock_guard<std::mutex> Lock(mutex);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < events.size(); i++)
+    {
+      const event &e = events[i];
+      fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"compile\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                 "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"item\":\"%s\"}}",
+              i ? ",\n" : "", e.phase, e.tid, e.start / 1000.0, e.duration / 1000.0,
+              escape(e.item).c_str());
+    }
+    fprintf(f, "\n]}\n");
+    return !fclose(f);
+  }
+
+  /// self_times - Duration of each event minus the events nested directly
+  /// in it on the same thread. mutex is held.
+  std::vector<uint64_t> self_times()
+  {
+    std::vector<size_t> order(events.size());
+    for (size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+
+    // Per thread by start, an enclosing event before the events in it.
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b)
+    {
+      const event &x = events[a];
+      const event &y = events[b];
+      if (x.tid != y.tid)
+        return x.tid < y.tid;
+      if (x.start != y.start)
+        return x.start < y.start;
+      return x.duration > y.duration;
+    });
+
+    std::vector<uint64_t> self(events.size());
+    std::vector<size_t> open;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const event &e = events[order[i]];
+      self[order[i]] = e.duration;
+
+      while (!open.empty())
+      {
+        const event &p = events[open.back()];
+        if (p.tid == e.tid && e.start + e.duration <= p.start + p.duration)
+          break;
+        open.pop_back();
+      }
+      if (!open.empty())
+        self[open.back()] -= std::min(self[open.back()], e.duration);
+      open.push_back(order[i]);
+    }
+    return self;
+  }
+
+  /// print_summary - Total, mean and maximum self time per phase, with the
+  /// item that took the longest.
+  void print_summary()
+  {
+    struct phase_total
+    {
+      uint64_t count = 0;
+      uint64_t total = 0;
+      uint64_t max = 0;
+      std::string slowest;
+    };
+
+    std::lock_guard<std::mutex> Lock(mutex);
+    std::vector<uint64_t> self = self_times();
+    std::vector<const char *> order;
+    std::map<std::string, phase_total> totals;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+      const event &e = events[i];
+      if (!totals.count(e.phase))
+        order.push_back(e.phase);
+      phase_total &t = totals[e.phase];
+      t.count++;
+      t.total += self[i];
+      if (self[i] >= t.max)
+      {
+        t.max = self[i];
+        t.slowest = e.item;
+      }
+    }
+
+    fprintf(stderr, "%-10s %8s %12s %12s %12s  %s\n", "phase", "count", "self ms", "mean ms", "max ms", "slowest");
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const phase_total &t = totals[order[i]];
+      fprintf(stderr, "%-10s %8llu %12.3f %12.3f %12.3f  %s\n", order[i],
+              (unsigned long long)t.count, t.total / 1e6, t.total / 1e6 / t.count, t.max / 1e6,
+              t.slowest.c_str());
+    }
+  }
+
+  static trace* get_instance()
+  {
+    static trace t;
+    return &t;
+  }
+};
+
+/// trace_scope - Record the time until the end of the scope as phase, if
+/// tracing is on, and the memory allocated meanwhile, if memory_stats is on.
+/// Costs two branches otherwise.
+class trace_scope
+{
+  const char *phase;
+  uint64_t start;
+  bool timed;
+  bool measured;
+  memory_stats::snapshot memory;
+
+public:
+
+  trace_scope(const char *name)
+    : phase(name),
+      start(0),
+      timed(trace::get_instance()->is_enabled()),
+      measured(memory_stats::get_instance()->is_enabled())
+  {
+    if (timed)
+      start = trace::get_instance()->now();
+    if (measured)
+      memory = memory_stats::get_instance()->begin();
+  }
+
+  ~trace_scope()
+  {
+    end();
+  }
+
+  /// end - Record the phase now rather than at the end of the scope.
+  void end()
+  {
+    if (timed)
+      trace::get_instance()->record(phase, start, trace::get_instance()->now());
+    if (measured)
+      memory_stats::get_instance()->end(phase, trace::get_instance()->get_item(), memory);
+    timed = measured = false;
+  }
+
+  uint64_t get_start()
+  {
+    return start;
+  }
+};
+
+#endif